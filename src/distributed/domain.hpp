@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/solver.hpp"
+
+constexpr int32_t DOMAIN_HALO_CELLS = 1;
+
+struct DomainParticle {
+  sf::Vector2f curr_position;
+  sf::Vector2f last_position;
+  float radius;
+  sf::Color colour;
+};
+
+struct DomainMessageHeader {
+  uint32_t migrant_count;
+  uint32_t ghost_count;
+};
+
+// Splits the world into vertical slabs of whole collision grid columns, one
+// per rank, in the same way solveCollisionsThreaded splits it into stripes
+// across threads. Each rank runs its own Solver over the whole world but
+// only holds the particles in its slab. Every frame, particles that left
+// the slab migrate to the neighbour they crossed into, and the particles
+// within DOMAIN_HALO_CELLS columns of each boundary are sent to that
+// neighbour as ghosts: ordinary particles in its solver for the frame, so
+// its own particles collide with them, discarded when the frame is over.
+// Both sides resolve a contact across the boundary, each keeping the
+// correction to its own particle, so neither has to send it back.
+//
+// Only free particles are supported; the solver must not hold constraints
+// or bodies. Ghosts lag their owners by up to a frame, so the halo is only
+// exact while a particle moves less than a cell per frame.
+template <typename Transport> struct SlabDomain {
+  SlabDomain(Solver &solver, Transport &transport)
+      : solver{solver}, transport{transport} {
+    const int32_t columns = solver.getGridWidth();
+    const uint32_t rank = transport.getRank();
+    const uint32_t rank_count = transport.getRankCount();
+    const float cell_size = solver.getCellSize();
+    first_column = static_cast<int64_t>(rank) * columns / rank_count;
+    last_column = static_cast<int64_t>(rank + 1) * columns / rank_count;
+    min_x = rank ? first_column * cell_size
+                 : -std::numeric_limits<float>::infinity();
+    max_x = rank + 1 < rank_count ? last_column * cell_size
+                                  : std::numeric_limits<float>::infinity();
+    halo_width = DOMAIN_HALO_CELLS * cell_size;
+    owned_count = solver.objects.size();
+  }
+
+  bool owns(sf::Vector2f position) const {
+    return position.x >= min_x && position.x < max_x;
+  }
+
+  // Adds the particle if it falls in this rank's slab, so every rank can be
+  // given the same global list of particles. Returns null otherwise.
+  VerletObject *addObject(sf::Vector2f position, float radius) {
+    if (!owns(position))
+      return nullptr;
+    VerletObject &object = solver.addObject(position, radius);
+    owned_count = solver.objects.size();
+    return &object;
+  }
+
+  // Exchanges migrants and ghosts with both neighbours, calls update(solver)
+  // to advance the frame, then drops the ghosts. Every rank must call step
+  // the same number of times. Returns false if a neighbour was lost.
+  template <typename UpdateCallback> bool step(UpdateCallback &&update) {
+    if (!exchange())
+      return false;
+    update(solver);
+    solver.objects.resize(owned_count);
+    return true;
+  }
+
+  uint32_t getOwnedCount() const { return owned_count; }
+
+  uint32_t getGhostCount() const { return ghost_count; }
+
+  // Particles that arrived from and left for neighbours in the last step.
+  uint32_t getMigratedIn() const { return migrated_in; }
+
+  uint32_t getMigratedOut() const { return migrated_out; }
+
+  int32_t getFirstColumn() const { return first_column; }
+
+  int32_t getLastColumn() const { return last_column; }
+
+private:
+  Solver &solver;
+  Transport &transport;
+  int32_t first_column;
+  int32_t last_column;
+  float min_x;
+  float max_x;
+  float halo_width;
+  uint32_t owned_count;
+  uint32_t ghost_count = 0;
+  uint32_t migrated_in = 0;
+  uint32_t migrated_out = 0;
+  std::vector<DomainParticle> migrants[2];
+  std::vector<DomainParticle> ghosts[2];
+  std::vector<uint8_t> message;
+
+  bool exchange() {
+    std::vector<VerletObject> &objects = solver.objects;
+    migrants[0].clear();
+    migrants[1].clear();
+    ghosts[0].clear();
+    ghosts[1].clear();
+    for (uint32_t idx = 0; idx < objects.size();) {
+      const float x = objects[idx].curr_position.x;
+      if (owns(objects[idx].curr_position)) {
+        idx++;
+        continue;
+      }
+      migrants[x < min_x ? 0 : 1].push_back(toParticle(objects[idx]));
+      objects[idx] = objects.back();
+      objects.pop_back();
+    }
+    migrated_out = migrants[0].size() + migrants[1].size();
+    for (const VerletObject &object : objects) {
+      if (object.curr_position.x < min_x + halo_width) {
+        ghosts[0].push_back(toParticle(object));
+      }
+      if (object.curr_position.x >= max_x - halo_width) {
+        ghosts[1].push_back(toParticle(object));
+      }
+    }
+
+    // Everything is sent before anything is received, so neither neighbour
+    // waits on the other.
+    const uint32_t rank = transport.getRank();
+    const bool has_neighbour[2] = {rank > 0,
+                                   rank + 1 < transport.getRankCount()};
+    const uint32_t neighbour[2] = {rank - 1, rank + 1};
+    for (uint32_t side = 0; side < 2; side++) {
+      if (has_neighbour[side] &&
+          !transport.send(neighbour[side],
+                          encode(migrants[side], ghosts[side])))
+        return false;
+    }
+    migrated_in = 0;
+    ghosts[0].clear();
+    ghosts[1].clear();
+    for (uint32_t side = 0; side < 2; side++) {
+      if (has_neighbour[side] &&
+          (!transport.receive(neighbour[side], message) ||
+           !decode(message, ghosts[side])))
+        return false;
+    }
+    owned_count = objects.size();
+    ghost_count = 0;
+    for (uint32_t side = 0; side < 2; side++) {
+      for (const DomainParticle &ghost : ghosts[side]) {
+        addParticle(ghost);
+        ghost_count++;
+      }
+    }
+    return true;
+  }
+
+  std::vector<uint8_t> &encode(const std::vector<DomainParticle> &side_migrants,
+                               const std::vector<DomainParticle> &side_ghosts) {
+    const DomainMessageHeader header{
+        static_cast<uint32_t>(side_migrants.size()),
+        static_cast<uint32_t>(side_ghosts.size())};
+    message.resize(sizeof(header) + (side_migrants.size() + side_ghosts.size()) *
+                                        sizeof(DomainParticle));
+    uint8_t *cursor = message.data();
+    std::memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    std::memcpy(cursor, side_migrants.data(),
+                side_migrants.size() * sizeof(DomainParticle));
+    cursor += side_migrants.size() * sizeof(DomainParticle);
+    std::memcpy(cursor, side_ghosts.data(),
+                side_ghosts.size() * sizeof(DomainParticle));
+    return message;
+  }
+
+  // Migrants join this rank's particles straight away; ghosts are kept
+  // until both neighbours have been heard from, so they end up after every
+  // owned particle.
+  bool decode(const std::vector<uint8_t> &received,
+              std::vector<DomainParticle> &side_ghosts) {
+    DomainMessageHeader header;
+    if (received.size() < sizeof(header))
+      return false;
+    std::memcpy(&header, received.data(), sizeof(header));
+    if (received.size() !=
+        sizeof(header) + (uint64_t{header.migrant_count} + header.ghost_count) *
+                             sizeof(DomainParticle))
+      return false;
+    const uint8_t *cursor = received.data() + sizeof(header);
+    for (uint32_t idx = 0; idx < header.migrant_count; idx++) {
+      DomainParticle migrant;
+      std::memcpy(&migrant, cursor, sizeof(migrant));
+      cursor += sizeof(migrant);
+      addParticle(migrant);
+      migrated_in++;
+    }
+    side_ghosts.resize(header.ghost_count);
+    std::memcpy(side_ghosts.data(), cursor,
+                header.ghost_count * sizeof(DomainParticle));
+    return true;
+  }
+
+  static DomainParticle toParticle(const VerletObject &object) {
+    return {object.curr_position, object.last_position, object.radius,
+            object.colour};
+  }
+
+  void addParticle(const DomainParticle &particle) {
+    VerletObject &object =
+        solver.addObject(particle.curr_position, particle.radius);
+    object.last_position = particle.last_position;
+    object.colour = particle.colour;
+  }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "../network/connection.hpp"
+
+constexpr int32_t TRANSPORT_CONNECT_ATTEMPTS = 500;
+constexpr auto TRANSPORT_CONNECT_INTERVAL = std::chrono::milliseconds(10);
+
+// Transports carry messages between the ranks of a decomposition. Each one
+// provides
+//   uint32_t getRank() const;
+//   uint32_t getRankCount() const;
+//   bool send(uint32_t rank, const std::vector<uint8_t> &message);
+//   bool receive(uint32_t rank, std::vector<uint8_t> &message);
+// where send never waits for the receiver, receive waits for the next
+// message from that rank, and messages between two ranks arrive in the
+// order they were sent. Both return false if the other rank is unreachable.
+
+// Ranks are threads of one process, passing messages through shared memory.
+// Useful for testing a decomposition, or for running one on a single box
+// without sockets.
+struct LocalTransport {
+  // The mailboxes shared by every rank.
+  struct Network {
+    explicit Network(uint32_t rank_count)
+        : rank_count{rank_count}, mailboxes(rank_count * rank_count) {}
+
+    uint32_t rank_count;
+    std::vector<std::deque<std::vector<uint8_t>>> mailboxes;
+    std::mutex mutex;
+    std::condition_variable condition;
+  };
+
+  LocalTransport(Network &network, uint32_t rank)
+      : network{network}, rank{rank} {}
+
+  uint32_t getRank() const { return rank; }
+
+  uint32_t getRankCount() const { return network.rank_count; }
+
+  bool send(uint32_t target, const std::vector<uint8_t> &message) {
+    if (target >= network.rank_count)
+      return false;
+    {
+      std::lock_guard<std::mutex> lock{network.mutex};
+      getMailbox(rank, target).push_back(message);
+    }
+    network.condition.notify_all();
+    return true;
+  }
+
+  bool receive(uint32_t source, std::vector<uint8_t> &message) {
+    if (source >= network.rank_count)
+      return false;
+    std::unique_lock<std::mutex> lock{network.mutex};
+    auto &mailbox = getMailbox(source, rank);
+    network.condition.wait(lock, [&mailbox] { return !mailbox.empty(); });
+    message = std::move(mailbox.front());
+    mailbox.pop_front();
+    return true;
+  }
+
+private:
+  Network &network;
+  uint32_t rank;
+
+  std::deque<std::vector<uint8_t>> &getMailbox(uint32_t from, uint32_t to) {
+    return network.mailboxes[from * network.rank_count + to];
+  }
+};
+
+// Ranks are processes on one machine, connected by Unix domain sockets at
+// path_prefix followed by the rank. Only neighbouring ranks are connected,
+// which is all a slab decomposition talks to.
+struct SocketTransport {
+  SocketTransport(const std::string &path_prefix, uint32_t rank,
+                  uint32_t rank_count)
+      : rank{rank}, rank_count{rank_count} {
+    const std::string path = path_prefix + std::to_string(rank);
+    const int listener = rank + 1 < rank_count ? listenOn(path) : -1;
+    if (rank > 0) {
+      left = Connection{connectWithRetry(path_prefix + std::to_string(rank - 1))};
+    }
+    if (listener >= 0) {
+      pollfd waiting{listener, POLLIN, 0};
+      if (::poll(&waiting, 1, TRANSPORT_CONNECT_ATTEMPTS *
+                                  TRANSPORT_CONNECT_INTERVAL.count()) > 0) {
+        right = Connection{::accept(listener, nullptr, nullptr)};
+      }
+      ::close(listener);
+      ::unlink(path.c_str());
+    }
+  }
+
+  // False if a neighbour could not be connected.
+  bool isConnected() const {
+    return (rank == 0 || left.isOpen()) &&
+           (rank + 1 == rank_count || right.isOpen());
+  }
+
+  uint32_t getRank() const { return rank; }
+
+  uint32_t getRankCount() const { return rank_count; }
+
+  bool send(uint32_t target, const std::vector<uint8_t> &message) {
+    Connection *connection = getConnection(target);
+    if (!connection || !connection->isOpen())
+      return false;
+    connection->writeMessage(0, message.data(), message.size());
+    return connection->flush();
+  }
+
+  // Keeps both neighbours' queued writes moving while it waits, so two ranks
+  // sending each other large messages cannot deadlock.
+  bool receive(uint32_t source, std::vector<uint8_t> &message) {
+    Connection *connection = getConnection(source);
+    if (!connection)
+      return false;
+    while (connection->isOpen()) {
+      uint32_t type;
+      const uint8_t *data;
+      uint32_t size;
+      if (connection->readMessage(type, data, size)) {
+        message.assign(data, data + size);
+        return true;
+      }
+      pollfd waiting[2];
+      uint32_t waiting_count = 0;
+      for (Connection *neighbour : {&left, &right}) {
+        if (neighbour->isOpen()) {
+          short events = 0;
+          if (neighbour == connection)
+            events |= POLLIN;
+          if (neighbour->getPendingBytes() > 0)
+            events |= POLLOUT;
+          pollfd &entry = waiting[waiting_count++];
+          entry.fd = neighbour->getDescriptor();
+          entry.events = events;
+          entry.revents = 0;
+        }
+      }
+      ::poll(waiting, waiting_count, -1);
+      left.flush();
+      right.flush();
+      connection->receive();
+    }
+    return false;
+  }
+
+private:
+  uint32_t rank;
+  uint32_t rank_count;
+  Connection left;
+  Connection right;
+
+  Connection *getConnection(uint32_t other) {
+    if (other + 1 == rank)
+      return &left;
+    if (other == rank + 1)
+      return &right;
+    return nullptr;
+  }
+
+  // The neighbour may not be listening yet when this rank starts.
+  static int connectWithRetry(const std::string &path) {
+    for (int32_t attempt = 0; attempt < TRANSPORT_CONNECT_ATTEMPTS;
+         attempt++) {
+      const int fd = connectTo(path);
+      if (fd >= 0)
+        return fd;
+      std::this_thread::sleep_for(TRANSPORT_CONNECT_INTERVAL);
+    }
+    return -1;
+  }
+};
@@ -1,6 +1,8 @@
 #include <SFML/Graphics.hpp>
 
+#include "simulation/playback.hpp"
 #include "simulation/simulation.hpp"
+#include "simulation/viewer.hpp"
 
 constexpr bool RENDER_DISPLAY = true;
 constexpr int32_t WINDOW_WIDTH = 1500;
@@ -14,15 +16,44 @@ constexpr bool SPEED_COLOURING = true;
 constexpr int32_t MAX_OBJECT_COUNT = 10000;
 constexpr int32_t FRAMERATE_LIMIT = 60;
 constexpr int32_t THREAD_COUNT = 3;
+constexpr bool PIN_THREADS = false;
 constexpr int32_t SUBSTEPS = 8;
 
 constexpr int8_t COLLISION_RESOLVER = 1;
 
 bool GRAVITY_ON = true;
 
+constexpr float LONG_RANGE_STRENGTH = 0.0f;
+constexpr float OPENING_ANGLE = 0.5f;
+
+constexpr bool DETERMINISTIC = false;
+constexpr uint32_t SEED = 0;
+
 const std::string NAME = "Multithreaded Physics Engine";
 
+const std::string RECORDING_PATH = "";
+const std::vector<std::string> PLAYBACK_PATHS = {};
+const std::string EXPORT_DIRECTORY = "";
+const std::string EXPORT_FORMAT = "png";
+
+const std::string SERVER_ADDRESS = "";
+const std::string VIEWER_ADDRESS = "";
+constexpr float VIEWER_FRAME_RATE = 0.0f;
+constexpr uint32_t VIEWER_BYTES_PER_SECOND = 0;
+
+constexpr float IDLE_DURATION = 0.0f;
+
 int main() {
+    if (!PLAYBACK_PATHS.empty()) {
+        Playback playback{PLAYBACK_PATHS, NAME};
+        playback.run();
+        return 0;
+    }
+    if (!VIEWER_ADDRESS.empty()) {
+        Viewer viewer{VIEWER_ADDRESS, NAME, VIEWER_FRAME_RATE, VIEWER_BYTES_PER_SECOND};
+        viewer.run();
+        return 0;
+    }
     Simulation simulation{
         RENDER_DISPLAY,
         WINDOW_WIDTH,
@@ -38,6 +69,24 @@ int main() {
         GRAVITY_ON,
         NAME
     };
+    if (DETERMINISTIC) {
+        simulation.setDeterministic(SEED);
+    }
+    if (PIN_THREADS) {
+        simulation.pinThreads();
+    }
+    if (LONG_RANGE_STRENGTH) {
+        simulation.setLongRangeForce(LONG_RANGE_STRENGTH, OPENING_ANGLE);
+    }
+    if (!RECORDING_PATH.empty()) {
+        simulation.record(RECORDING_PATH);
+    }
+    if (!EXPORT_DIRECTORY.empty()) {
+        simulation.exportFrames(EXPORT_DIRECTORY, EXPORT_FORMAT);
+    }
+    if (!SERVER_ADDRESS.empty()) {
+        simulation.serve(SERVER_ADDRESS);
+    }
     /*
     simulation.spawnRope(
         length,
@@ -66,6 +115,14 @@ int main() {
         side_count,
         side_length
     )
+    simulation.addForceField(
+        {type, position, radius, strength, direction, falloff}
+    )
+    simulation.addStaticSegment(start, end)
+    simulation.addStaticCapsule(start, end, radius)
+    simulation.addStaticPolygon({corner, corner, corner, ...})
+    simulation.setCoarseInterval(interval, rest_speed)
+    simulation.addDetailRegion(min, max)
     */
     simulation.spawnRope(
         20,
@@ -105,6 +162,6 @@ int main() {
         0.005f,
         30.0f
     );
-    simulation.idle();
+    simulation.idle(IDLE_DURATION);
     return 0;
 }
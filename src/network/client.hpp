@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+
+#include <SFML/Graphics.hpp>
+
+#include "connection.hpp"
+#include "state-stream.hpp"
+
+// Receives the state a SimulationServer streams and sends commands back.
+// Nothing blocks except connecting: poll reads whatever has arrived.
+struct SimulationClient {
+  // frame_rate and bytes_per_second cap what the server sends; zero takes
+  // the server's defaults.
+  SimulationClient(const std::string &address, float frame_rate,
+                   uint32_t bytes_per_second)
+      : connection{connectTo(address)} {
+    const StreamSubscribe subscribe{frame_rate, bytes_per_second};
+    connection.writeMessage(static_cast<uint32_t>(StreamMessage::Subscribe),
+                            &subscribe, sizeof(subscribe));
+    connection.flush();
+  }
+
+  bool isOpen() const { return connection.isOpen(); }
+
+  // True once the server's hello has arrived.
+  bool isReady() const { return hello_received; }
+
+  sf::Vector2f getSize() const { return hello.size; }
+
+  float getFrameDt() const { return hello.frame_dt; }
+
+  // Reads and decodes everything received. Returns the number of frames
+  // decoded; view() shows the newest.
+  uint32_t poll() {
+    connection.flush();
+    connection.receive();
+    uint32_t frame_count = 0;
+    uint32_t type;
+    const uint8_t *data;
+    uint32_t size;
+    while (connection.readMessage(type, data, size)) {
+      bool valid = true;
+      switch (static_cast<StreamMessage>(type)) {
+      case StreamMessage::Hello:
+        valid = size == sizeof(hello);
+        if (valid) {
+          std::memcpy(&hello, data, sizeof(hello));
+          valid = hello.version == STREAM_VERSION;
+          hello_received = valid;
+        }
+        break;
+      case StreamMessage::Keyframe:
+        valid = decoder.decodeKeyframe(data, size);
+        has_keyframe = valid;
+        frame_count += valid;
+        break;
+      case StreamMessage::Delta:
+        valid = has_keyframe && decoder.decodeDelta(data, size);
+        frame_count += valid;
+        break;
+      case StreamMessage::CommandResult: {
+        StreamCommandResult result;
+        valid = size == sizeof(result);
+        if (valid) {
+          std::memcpy(&result, data, sizeof(result));
+          results.push_back(result.value);
+        }
+        break;
+      }
+      default:
+        valid = false;
+      }
+      if (!valid) {
+        connection.close();
+      }
+    }
+    return frame_count;
+  }
+
+  bool hasFrame() const { return has_keyframe; }
+
+  FrameView view() const { return decoder.view(); }
+
+  void sendCommand(const StreamCommand &command) {
+    connection.writeMessage(static_cast<uint32_t>(StreamMessage::Command),
+                            &command, sizeof(command));
+    connection.flush();
+  }
+
+  // Results arrive in the order the commands were sent.
+  bool popCommandResult(uint32_t &value) {
+    if (results.empty())
+      return false;
+    value = results.front();
+    results.pop_front();
+    return true;
+  }
+
+private:
+  Connection connection;
+  StreamHello hello{};
+  bool hello_received = false;
+  bool has_keyframe = false;
+  StateDecoder decoder;
+  std::deque<uint32_t> results;
+};
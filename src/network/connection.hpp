@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr uint32_t CONNECTION_READ_CHUNK = 64 * 1024;
+constexpr uint32_t CONNECTION_MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
+#ifdef MSG_NOSIGNAL
+constexpr int CONNECTION_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int CONNECTION_SEND_FLAGS = 0;
+#endif
+
+struct MessageHeader {
+  uint32_t type;
+  uint32_t size;
+};
+
+// Addresses containing a '/' are Unix domain socket paths; anything else is
+// a TCP port on the loopback interface.
+inline bool isUnixAddress(const std::string &address) {
+  return address.find('/') != std::string::npos;
+}
+
+inline bool setNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Returns a non-blocking listening socket, or -1.
+inline int listenOn(const std::string &address) {
+  int fd = -1;
+  if (isUnixAddress(address)) {
+    sockaddr_un local{};
+    if (address.size() >= sizeof(local.sun_path))
+      return -1;
+    local.sun_family = AF_UNIX;
+    std::strcpy(local.sun_path, address.c_str());
+    // A socket file left behind by an earlier server would make bind fail.
+    struct stat status;
+    if (::stat(address.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+      ::unlink(address.c_str());
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        bind(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0) {
+      if (fd >= 0)
+        ::close(fd);
+      return -1;
+    }
+  } else {
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(std::atoi(address.c_str()));
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int reuse = 1;
+    if (fd < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0) {
+      if (fd >= 0)
+        ::close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd)) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Connects (blocking) and returns the socket, or -1.
+inline int connectTo(const std::string &address) {
+  int fd = -1;
+  if (isUnixAddress(address)) {
+    sockaddr_un remote{};
+    if (address.size() >= sizeof(remote.sun_path))
+      return -1;
+    remote.sun_family = AF_UNIX;
+    std::strcpy(remote.sun_path, address.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&remote),
+                           sizeof(remote)) != 0) {
+      ::close(fd);
+      return -1;
+    }
+  } else {
+    sockaddr_in remote{};
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons(std::atoi(address.c_str()));
+    remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&remote),
+                           sizeof(remote)) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    const int no_delay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+  }
+  return fd;
+}
+
+// A non-blocking stream socket carrying messages framed by a MessageHeader.
+// Writes are queued and go out as the socket accepts them, so a slow reader
+// never stalls the writer; getPendingBytes tells how far behind it is.
+struct Connection {
+  explicit Connection(int fd = -1) : fd{fd} {
+    if (fd >= 0 && !setNonBlocking(fd)) {
+      close();
+    }
+  }
+
+  Connection(Connection &&other) noexcept { *this = std::move(other); }
+
+  Connection &operator=(Connection &&other) noexcept {
+    if (this != &other) {
+      close();
+      fd = other.fd;
+      outgoing = std::move(other.outgoing);
+      incoming = std::move(other.incoming);
+      sent = other.sent;
+      received = other.received;
+      other.fd = -1;
+    }
+    return *this;
+  }
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  ~Connection() { close(); }
+
+  bool isOpen() const { return fd >= 0; }
+
+  int getDescriptor() const { return fd; }
+
+  uint32_t getPendingBytes() const { return outgoing.size() - sent; }
+
+  void writeMessage(uint32_t type, const void *payload, uint32_t size) {
+    const MessageHeader header{type, size};
+    append(&header, sizeof(header));
+    append(payload, size);
+  }
+
+  // Sends as much of the queue as the socket takes without blocking.
+  // Returns false once the connection is lost.
+  bool flush() {
+    while (isOpen() && sent < outgoing.size()) {
+      const ssize_t count = ::send(fd, outgoing.data() + sent,
+                                   outgoing.size() - sent,
+                                   CONNECTION_SEND_FLAGS);
+      if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          break;
+        close();
+      } else {
+        sent += count;
+      }
+    }
+    if (sent == outgoing.size()) {
+      outgoing.clear();
+      sent = 0;
+    }
+    return isOpen();
+  }
+
+  // Reads everything that has arrived. Returns false once the connection is
+  // closed by the other end or fails.
+  bool receive() {
+    incoming.erase(incoming.begin(), incoming.begin() + received);
+    received = 0;
+    while (isOpen()) {
+      const uint64_t size = incoming.size();
+      incoming.resize(size + CONNECTION_READ_CHUNK);
+      const ssize_t count = ::recv(fd, incoming.data() + size,
+                                   CONNECTION_READ_CHUNK, 0);
+      incoming.resize(size + std::max<ssize_t>(count, 0));
+      if (count < 0 &&
+          (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        break;
+      if (count <= 0) {
+        close();
+      }
+    }
+    return isOpen();
+  }
+
+  // Takes the next complete message received, if there is one. The payload
+  // stays valid until the next receive.
+  bool readMessage(uint32_t &type, const uint8_t *&payload, uint32_t &size) {
+    MessageHeader header;
+    if (incoming.size() - received < sizeof(header))
+      return false;
+    std::memcpy(&header, incoming.data() + received, sizeof(header));
+    if (header.size > CONNECTION_MAX_MESSAGE_SIZE) {
+      close();
+      return false;
+    }
+    if (incoming.size() - received < sizeof(header) + header.size)
+      return false;
+    type = header.type;
+    payload = incoming.data() + received + sizeof(header);
+    size = header.size;
+    received += sizeof(header) + header.size;
+    return true;
+  }
+
+  void close() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    fd = -1;
+  }
+
+private:
+  int fd = -1;
+  std::vector<uint8_t> outgoing;
+  std::vector<uint8_t> incoming;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+
+  void append(const void *data, uint32_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    outgoing.insert(outgoing.end(), bytes, bytes + size);
+  }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/solver.hpp"
+#include "connection.hpp"
+#include "state-stream.hpp"
+
+constexpr uint32_t SERVER_MAX_CLIENTS = 32;
+constexpr float SERVER_DEFAULT_FRAME_RATE = 30.0f;
+constexpr float SERVER_MIN_FRAME_RATE = 1.0f / 3600.0f;
+constexpr float SERVER_MAX_FRAME_RATE = 1000.0f;
+constexpr uint32_t SERVER_MIN_BYTES_PER_SECOND = 1024;
+constexpr uint32_t SERVER_MAX_BYTES_PER_SECOND = 8 * 1024 * 1024;
+constexpr uint32_t SERVER_KEYFRAME_INTERVAL = 300;
+constexpr uint32_t SERVER_MAX_PENDING_BYTES = 1024 * 1024;
+
+// Serves the state of one Solver to any number of viewer or analysis
+// clients, so one simulation can feed several cheap viewers. Each client
+// gets a keyframe, then deltas (see StateEncoder), at no more than the
+// frame rate and byte rate it subscribed with: the byte rate is a token
+// bucket refilled continuously, and a client whose bucket is empty, or whose
+// socket has not drained the last frame, simply skips frames. Everything
+// runs on the caller's thread, between solver updates, and a client gets at
+// most one frame per publish.
+struct SimulationServer {
+  SimulationServer(const std::string &address, sf::Vector2f size,
+                   float frame_dt)
+      : address{address}, listener{listenOn(address)},
+        hello{STREAM_VERSION, size, frame_dt} {}
+
+  SimulationServer(const SimulationServer &) = delete;
+  SimulationServer &operator=(const SimulationServer &) = delete;
+
+  ~SimulationServer() {
+    if (listener >= 0) {
+      ::close(listener);
+      if (isUnixAddress(address)) {
+        ::unlink(address.c_str());
+      }
+    }
+  }
+
+  bool isOpen() const { return listener >= 0; }
+
+  uint32_t getClientCount() const { return clients.size(); }
+
+  // Accepts new clients and reads what the existing ones sent. Each command
+  // is passed to apply, whose return value is sent back to the client as
+  // its StreamCommandResult.
+  template <typename CommandCallback> void poll(CommandCallback &&apply) {
+    if (!isOpen())
+      return;
+    acceptClients();
+    poll_fds.clear();
+    for (const Client &client : clients) {
+      poll_fds.push_back({client.connection.getDescriptor(), POLLIN, 0});
+    }
+    if (!poll_fds.empty() && ::poll(poll_fds.data(), poll_fds.size(), 0) > 0) {
+      for (uint32_t idx = 0; idx < clients.size(); idx++) {
+        if (poll_fds[idx].revents) {
+          clients[idx].connection.receive();
+          readMessages(clients[idx], apply);
+        }
+      }
+    }
+    removeClosedClients();
+  }
+
+  // Sends the solver's current state to every client that is due a frame.
+  void publish(const Solver &solver) {
+    if (clients.empty())
+      return;
+    const Clock::time_point now = Clock::now();
+    bool captured = false;
+    for (Client &client : clients) {
+      client.connection.flush();
+      refill(client, now);
+      if (!client.subscribed || now < client.next_frame_at ||
+          client.tokens <= 0.0 ||
+          client.connection.getPendingBytes() > SERVER_MAX_PENDING_BYTES)
+        continue;
+      if (!captured) {
+        captureFrame(solver);
+        captured = true;
+      }
+      const bool keyframe =
+          client.topology_version != topology_version ||
+          client.frames_since_keyframe >= SERVER_KEYFRAME_INTERVAL ||
+          client.encoder.getObjectCount() > frame.objects.size();
+      if (keyframe) {
+        client.encoder.encodeKeyframe(frame, payload);
+        client.topology_version = topology_version;
+        client.frames_since_keyframe = 0;
+      } else {
+        client.encoder.encodeDelta(frame, payload);
+        client.frames_since_keyframe++;
+      }
+      client.connection.writeMessage(
+          static_cast<uint32_t>(keyframe ? StreamMessage::Keyframe
+                                         : StreamMessage::Delta),
+          payload.data(), payload.size());
+      client.tokens -= payload.size() + sizeof(MessageHeader);
+      client.next_frame_at += client.frame_interval;
+      if (client.next_frame_at < now) {
+        client.next_frame_at = now + client.frame_interval;
+      }
+      client.connection.flush();
+    }
+    removeClosedClients();
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Client {
+    Connection connection;
+    StateEncoder encoder;
+    bool subscribed = false;
+    Clock::duration frame_interval{};
+    Clock::time_point next_frame_at{};
+    uint32_t bytes_per_second = 0;
+    double tokens = 0.0;
+    Clock::time_point refilled_at{};
+    uint32_t topology_version = UINT32_MAX;
+    uint32_t frames_since_keyframe = 0;
+  };
+
+  std::string address;
+  int listener;
+  StreamHello hello;
+  std::vector<Client> clients;
+  std::vector<pollfd> poll_fds;
+  FrameSnapshot frame;
+  std::vector<uint32_t> last_lines;
+  std::vector<uint32_t> last_polygon_offsets;
+  std::vector<uint32_t> last_polygon_indices;
+  uint32_t last_static_version = 0;
+  std::vector<float> last_radii;
+  uint32_t topology_version = 0;
+  std::vector<uint8_t> payload;
+
+  void acceptClients() {
+    while (true) {
+      const int fd = ::accept(listener, nullptr, nullptr);
+      if (fd < 0)
+        break;
+      if (clients.size() >= SERVER_MAX_CLIENTS) {
+        ::close(fd);
+        continue;
+      }
+      Client &client = clients.emplace_back();
+      client.connection = Connection{fd};
+      client.connection.writeMessage(
+          static_cast<uint32_t>(StreamMessage::Hello), &hello, sizeof(hello));
+      client.connection.flush();
+    }
+  }
+
+  template <typename CommandCallback>
+  void readMessages(Client &client, CommandCallback &apply) {
+    uint32_t type;
+    const uint8_t *data;
+    uint32_t size;
+    while (client.connection.readMessage(type, data, size)) {
+      if (type == static_cast<uint32_t>(StreamMessage::Subscribe) &&
+          size == sizeof(StreamSubscribe)) {
+        StreamSubscribe subscribe;
+        std::memcpy(&subscribe, data, sizeof(subscribe));
+        subscribeClient(client, subscribe);
+      } else if (type == static_cast<uint32_t>(StreamMessage::Command) &&
+                 size == sizeof(StreamCommand)) {
+        StreamCommand command;
+        std::memcpy(&command, data, sizeof(command));
+        const StreamCommandResult result{apply(command)};
+        client.connection.writeMessage(
+            static_cast<uint32_t>(StreamMessage::CommandResult), &result,
+            sizeof(result));
+      } else {
+        client.connection.close();
+      }
+    }
+    client.connection.flush();
+  }
+
+  // The rates come off the network, so they are clamped to a range whose
+  // frame interval is sure to fit in the clock's ticks.
+  void subscribeClient(Client &client, const StreamSubscribe &subscribe) {
+    const float frame_rate =
+        subscribe.frame_rate > 0.0f
+            ? std::min(std::max(subscribe.frame_rate, SERVER_MIN_FRAME_RATE),
+                       SERVER_MAX_FRAME_RATE)
+            : SERVER_DEFAULT_FRAME_RATE;
+    client.frame_interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(1.0f / frame_rate));
+    client.bytes_per_second =
+        subscribe.bytes_per_second
+            ? std::min(std::max(subscribe.bytes_per_second,
+                                SERVER_MIN_BYTES_PER_SECOND),
+                       SERVER_MAX_BYTES_PER_SECOND)
+            : SERVER_MAX_BYTES_PER_SECOND;
+    client.refilled_at = Clock::now();
+    client.next_frame_at = client.refilled_at;
+    client.tokens = client.bytes_per_second;
+    client.subscribed = true;
+  }
+
+  // The bucket holds at most one second of bytes. A frame is sent whenever
+  // the bucket is not empty and may overdraw it, so even a keyframe larger
+  // than the bucket goes out, followed by a proportionally longer pause.
+  static void refill(Client &client, Clock::time_point now) {
+    const double elapsed =
+        std::chrono::duration<double>(now - client.refilled_at).count();
+    client.tokens = std::min<double>(
+        client.tokens + elapsed * client.bytes_per_second,
+        client.bytes_per_second);
+    client.refilled_at = now;
+  }
+
+  // Deltas can only describe moved, recoloured or newly added objects, so
+  // any other change bumps the version and sends every client a keyframe.
+  void captureFrame(const Solver &solver) {
+    frame.capture(solver);
+    bool changed = frame.lines != last_lines ||
+                   frame.polygon_offsets != last_polygon_offsets ||
+                   frame.polygon_indices != last_polygon_indices ||
+                   frame.static_version != last_static_version ||
+                   frame.objects.size() < last_radii.size();
+    const uint32_t known_count =
+        std::min<uint32_t>(last_radii.size(), frame.objects.size());
+    for (uint32_t idx = 0; idx < known_count && !changed; idx++) {
+      changed = frame.objects[idx].radius != last_radii[idx];
+    }
+    if (changed) {
+      topology_version++;
+      last_lines = frame.lines;
+      last_polygon_offsets = frame.polygon_offsets;
+      last_polygon_indices = frame.polygon_indices;
+      last_static_version = frame.static_version;
+    }
+    last_radii.resize(frame.objects.size());
+    for (uint32_t idx = 0; idx < frame.objects.size(); idx++) {
+      last_radii[idx] = frame.objects[idx].radius;
+    }
+  }
+
+  void removeClosedClients() {
+    clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                 [](const Client &client) {
+                                   return !client.connection.isOpen();
+                                 }),
+                  clients.end());
+  }
+};
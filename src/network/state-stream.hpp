@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/force-field.hpp"
+#include "../renderer/frame.hpp"
+
+constexpr uint32_t STREAM_VERSION = 2;
+// Positions in deltas are in units of 1 / STREAM_POSITION_SCALE pixels.
+constexpr float STREAM_POSITION_SCALE = 16.0f;
+
+enum class StreamMessage : uint32_t {
+  Hello,
+  Subscribe,
+  Keyframe,
+  Delta,
+  Command,
+  CommandResult,
+};
+
+// Server to client, once on connection.
+struct StreamHello {
+  uint32_t version;
+  sf::Vector2f size;
+  float frame_dt;
+};
+
+// Client to server: the most the client wants to receive. Zero means the
+// server's default.
+struct StreamSubscribe {
+  float frame_rate;
+  uint32_t bytes_per_second;
+};
+
+// Followed by the FrameObjects, the line pairs, the polygon offsets and
+// indices, and the static collider outlines, laid out as in a recording.
+struct StreamKeyframeHeader {
+  float time;
+  uint32_t object_count;
+  uint32_t line_count;
+  uint32_t polygon_count;
+  uint32_t polygon_index_count;
+  uint32_t static_line_count;
+};
+
+// Followed by the FrameObjects of the objects added since the client's last
+// frame, then the StreamChanges.
+struct StreamDeltaHeader {
+  float time;
+  uint32_t object_count;
+  uint32_t change_count;
+};
+
+// A particle whose quantised position or colour differs from the client's
+// copy; dx and dy are relative to the client's quantised position.
+struct StreamChange {
+  uint32_t index;
+  int16_t dx;
+  int16_t dy;
+  sf::Color colour;
+};
+
+static_assert(sizeof(StreamChange) == 12, "StreamChange must stay packed");
+
+struct StreamCommand {
+  enum Type : uint8_t { Spawn, AddForceField, RemoveForceField, Toggle };
+  Type type;
+  // Toggle: one of SimulationCommand::Type, switched to active.
+  uint8_t toggle;
+  bool active;
+  // Spawn: a free particle.
+  sf::Vector2f position;
+  sf::Vector2f velocity;
+  float radius;
+  // AddForceField.
+  ForceField field;
+  // RemoveForceField.
+  uint32_t id;
+};
+
+// Replies to every command in the order they were sent: the new object's
+// index for Spawn, the field id for AddForceField, and otherwise 0.
+// STREAM_COMMAND_FAILED if the command could not be applied.
+struct StreamCommandResult {
+  uint32_t value;
+};
+
+constexpr uint32_t STREAM_COMMAND_FAILED = UINT32_MAX;
+
+inline sf::Vector2i quantisePosition(sf::Vector2f position) {
+  return {static_cast<int32_t>(std::lround(position.x * STREAM_POSITION_SCALE)),
+          static_cast<int32_t>(std::lround(position.y * STREAM_POSITION_SCALE))};
+}
+
+inline bool hasSameColour(sf::Color colour_1, sf::Color colour_2) {
+  return colour_1.r == colour_2.r && colour_1.g == colour_2.g &&
+         colour_1.b == colour_2.b && colour_1.a == colour_2.a;
+}
+
+// What one client has been sent so far. Keyframes carry the whole frame;
+// deltas carry only the particles that moved by at least one quantum or
+// changed colour since the client's copy, measured against the quantised
+// positions the client actually holds so the rounding error never builds
+// up however many frames a slow client skips.
+struct StateEncoder {
+  void encodeKeyframe(const FrameSnapshot &frame, std::vector<uint8_t> &out) {
+    const uint32_t polygon_count =
+        frame.polygon_offsets.empty() ? 0 : frame.polygon_offsets.size() - 1;
+    const StreamKeyframeHeader header{
+        frame.time,
+        static_cast<uint32_t>(frame.objects.size()),
+        static_cast<uint32_t>(frame.lines.size() / 2),
+        polygon_count,
+        static_cast<uint32_t>(frame.polygon_indices.size()),
+        static_cast<uint32_t>(frame.static_lines.size() / 2)};
+    out.clear();
+    append(out, &header, sizeof(header));
+    append(out, frame.objects.data(), frame.objects.size() * sizeof(FrameObject));
+    append(out, frame.lines.data(), frame.lines.size() * sizeof(uint32_t));
+    if (polygon_count) {
+      append(out, frame.polygon_offsets.data(),
+             frame.polygon_offsets.size() * sizeof(uint32_t));
+      append(out, frame.polygon_indices.data(),
+             frame.polygon_indices.size() * sizeof(uint32_t));
+    }
+    append(out, frame.static_lines.data(),
+           frame.static_lines.size() * sizeof(sf::Vector2f));
+    positions.resize(frame.objects.size());
+    colours.resize(frame.objects.size());
+    for (uint32_t idx = 0; idx < frame.objects.size(); idx++) {
+      positions[idx] = quantisePosition(frame.objects[idx].position);
+      colours[idx] = frame.objects[idx].colour;
+    }
+  }
+
+  // Objects may only have been added since the last frame sent; any other
+  // change to the objects, lines, polygons or static colliders needs a
+  // keyframe.
+  void encodeDelta(const FrameSnapshot &frame, std::vector<uint8_t> &out) {
+    const uint32_t known_count = positions.size();
+    out.resize(sizeof(StreamDeltaHeader));
+    append(out, frame.objects.data() + known_count,
+           (frame.objects.size() - known_count) * sizeof(FrameObject));
+    uint32_t change_count = 0;
+    for (uint32_t idx = 0; idx < known_count; idx++) {
+      const FrameObject &object = frame.objects[idx];
+      const sf::Vector2i target = quantisePosition(object.position);
+      const int32_t dx = std::clamp(target.x - positions[idx].x,
+                                    int32_t{INT16_MIN}, int32_t{INT16_MAX});
+      const int32_t dy = std::clamp(target.y - positions[idx].y,
+                                    int32_t{INT16_MIN}, int32_t{INT16_MAX});
+      if (!dx && !dy && hasSameColour(object.colour, colours[idx]))
+        continue;
+      const StreamChange change{idx, static_cast<int16_t>(dx),
+                                static_cast<int16_t>(dy), object.colour};
+      append(out, &change, sizeof(change));
+      positions[idx].x += dx;
+      positions[idx].y += dy;
+      colours[idx] = object.colour;
+      change_count++;
+    }
+    for (uint32_t idx = known_count; idx < frame.objects.size(); idx++) {
+      positions.push_back(quantisePosition(frame.objects[idx].position));
+      colours.push_back(frame.objects[idx].colour);
+    }
+    const StreamDeltaHeader header{
+        frame.time, static_cast<uint32_t>(frame.objects.size()), change_count};
+    std::memcpy(out.data(), &header, sizeof(header));
+  }
+
+  uint32_t getObjectCount() const { return positions.size(); }
+
+private:
+  std::vector<sf::Vector2i> positions;
+  std::vector<sf::Color> colours;
+
+  static void append(std::vector<uint8_t> &out, const void *data,
+                     uint64_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    out.insert(out.end(), bytes, bytes + size);
+  }
+};
+
+// The client's side of a StateEncoder. Each decoded delta keeps the
+// positions it replaced as the previous positions, so a viewer can draw
+// between the last two frames it received.
+struct StateDecoder {
+  bool decodeKeyframe(const uint8_t *data, uint32_t size) {
+    StreamKeyframeHeader header;
+    if (size < sizeof(header))
+      return false;
+    std::memcpy(&header, data, sizeof(header));
+    const uint64_t polygon_words =
+        header.polygon_count
+            ? header.polygon_count + 1 + uint64_t{header.polygon_index_count}
+            : 0;
+    if (size != sizeof(header) +
+                    uint64_t{header.object_count} * sizeof(FrameObject) +
+                    (2 * uint64_t{header.line_count} + polygon_words) *
+                        sizeof(uint32_t) +
+                    2 * uint64_t{header.static_line_count} *
+                        sizeof(sf::Vector2f))
+      return false;
+    const uint8_t *cursor = data + sizeof(header);
+    frame.time = header.time;
+    frame.objects.resize(header.object_count);
+    read(cursor, frame.objects.data(),
+         header.object_count * sizeof(FrameObject));
+    frame.lines.resize(2 * header.line_count);
+    read(cursor, frame.lines.data(), frame.lines.size() * sizeof(uint32_t));
+    frame.polygon_offsets.assign(1, 0u);
+    frame.polygon_indices.clear();
+    if (header.polygon_count) {
+      frame.polygon_offsets.resize(header.polygon_count + 1);
+      read(cursor, frame.polygon_offsets.data(),
+           frame.polygon_offsets.size() * sizeof(uint32_t));
+      frame.polygon_indices.resize(header.polygon_index_count);
+      read(cursor, frame.polygon_indices.data(),
+           frame.polygon_indices.size() * sizeof(uint32_t));
+    }
+    frame.static_lines.resize(2 * header.static_line_count);
+    read(cursor, frame.static_lines.data(),
+         frame.static_lines.size() * sizeof(sf::Vector2f));
+    frame.previous_positions.clear();
+    positions.resize(header.object_count);
+    for (uint32_t idx = 0; idx < header.object_count; idx++) {
+      positions[idx] = quantisePosition(frame.objects[idx].position);
+    }
+    return validateTopology();
+  }
+
+  bool decodeDelta(const uint8_t *data, uint32_t size) {
+    StreamDeltaHeader header;
+    if (size < sizeof(header))
+      return false;
+    std::memcpy(&header, data, sizeof(header));
+    const uint32_t known_count = positions.size();
+    if (header.object_count < known_count ||
+        size != sizeof(header) +
+                    uint64_t{header.object_count - known_count} *
+                        sizeof(FrameObject) +
+                    uint64_t{header.change_count} * sizeof(StreamChange))
+      return false;
+    const uint8_t *cursor = data + sizeof(header);
+    frame.time = header.time;
+    frame.previous_positions.resize(known_count);
+    for (uint32_t idx = 0; idx < known_count; idx++) {
+      frame.previous_positions[idx] = frame.objects[idx].position;
+    }
+    frame.objects.resize(header.object_count);
+    read(cursor, frame.objects.data() + known_count,
+         (header.object_count - known_count) * sizeof(FrameObject));
+    for (uint32_t idx = known_count; idx < header.object_count; idx++) {
+      positions.push_back(quantisePosition(frame.objects[idx].position));
+      frame.previous_positions.push_back(frame.objects[idx].position);
+    }
+    for (uint32_t idx = 0; idx < header.change_count; idx++) {
+      StreamChange change;
+      read(cursor, &change, sizeof(change));
+      if (change.index >= known_count)
+        return false;
+      sf::Vector2i &position = positions[change.index];
+      position.x += change.dx;
+      position.y += change.dy;
+      FrameObject &object = frame.objects[change.index];
+      object.position = {position.x / STREAM_POSITION_SCALE,
+                         position.y / STREAM_POSITION_SCALE};
+      object.colour = change.colour;
+    }
+    return true;
+  }
+
+  FrameView view() const { return frame.view(); }
+
+  uint32_t getObjectCount() const { return frame.objects.size(); }
+
+private:
+  FrameSnapshot frame;
+  std::vector<sf::Vector2i> positions;
+
+  static void read(const uint8_t *&cursor, void *target, uint64_t size) {
+    if (size) {
+      std::memcpy(target, cursor, size);
+    }
+    cursor += size;
+  }
+
+  // Line and polygon indices come from the wire, so they are checked before
+  // anything indexes the objects with them.
+  bool validateTopology() {
+    const uint32_t object_count = frame.objects.size();
+    for (const uint32_t idx : frame.lines) {
+      if (idx >= object_count)
+        return false;
+    }
+    for (const uint32_t idx : frame.polygon_indices) {
+      if (idx >= object_count)
+        return false;
+    }
+    for (uint32_t idx = 0; idx + 1 < frame.polygon_offsets.size(); idx++) {
+      if (frame.polygon_offsets[idx] > frame.polygon_offsets[idx + 1])
+        return false;
+    }
+    return frame.polygon_offsets.back() == frame.polygon_indices.size();
+  }
+};
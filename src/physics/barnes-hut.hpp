@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../thread_pool/thread_pool.hpp"
+#include "verlet.hpp"
+
+constexpr float DEFAULT_OPENING_ANGLE = 0.5f;
+constexpr float BARNES_HUT_SOFTENING = 5.0f;
+constexpr uint32_t BARNES_HUT_LEAF_CAPACITY = 8;
+constexpr int32_t BARNES_HUT_MAX_DEPTH = 24;
+constexpr int32_t BARNES_HUT_PARALLEL_DEPTH = 2;
+
+// Children are allocated in fours, so a node only stores its first child.
+// Every node covers a contiguous range of the object order, which is
+// partitioned in place as the tree is built.
+struct BarnesHutNode {
+  sf::Vector2f centre;
+  float half_size = 0.0f;
+  sf::Vector2f mass_centre;
+  float mass = 0.0f;
+  int32_t first_child = -1;
+  uint32_t begin = 0;
+  uint32_t end = 0;
+};
+
+// Quadtree for O(n log n) mutual forces between all particles. A node whose
+// size over its distance is below the opening angle is treated as a single
+// mass at its centre of mass. Masses scale with radius cubed, as they do in
+// collisions; a positive strength attracts and a negative one repels.
+struct BarnesHutTree {
+  std::vector<BarnesHutNode> nodes;
+  std::vector<uint32_t> order;
+  std::vector<sf::Vector2f> accelerations;
+
+  void build(const std::vector<VerletObject> &objects) {
+    if (!initialise(objects))
+      return;
+    buildSubtree(nodes, 0, 0, objects);
+  }
+
+  // The top BARNES_HUT_PARALLEL_DEPTH levels are split serially; every node
+  // left at that depth is then built as an independent subtree by one task
+  // and the subtrees are spliced in after the top levels.
+  void buildThreaded(const std::vector<VerletObject> &objects,
+                     tp::ThreadPool &thread_pool) {
+    if (!initialise(objects))
+      return;
+    std::vector<int32_t> frontier{0};
+    for (int32_t depth = 0; depth < BARNES_HUT_PARALLEL_DEPTH; depth++) {
+      std::vector<int32_t> next_frontier;
+      for (const int32_t node : frontier) {
+        if (split(nodes, node, depth, objects)) {
+          for (int32_t child = 0; child < 4; child++) {
+            next_frontier.push_back(nodes[node].first_child + child);
+          }
+        }
+      }
+      frontier.swap(next_frontier);
+    }
+    const uint32_t top_count = nodes.size();
+
+    subtrees.resize(frontier.size());
+    for (uint32_t idx = 0; idx < frontier.size(); idx++) {
+      thread_pool.enqueueTask([this, idx, &frontier, &objects] {
+        std::vector<BarnesHutNode> &subtree = subtrees[idx];
+        subtree.assign(1, nodes[frontier[idx]]);
+        buildSubtree(subtree, 0, BARNES_HUT_PARALLEL_DEPTH, objects);
+      });
+    }
+    thread_pool.completeAllTasks();
+
+    std::vector<uint32_t> offsets(frontier.size());
+    uint32_t node_count = top_count;
+    for (uint32_t idx = 0; idx < frontier.size(); idx++) {
+      offsets[idx] = node_count - 1;
+      node_count += subtrees[idx].size() - 1;
+    }
+    nodes.resize(node_count);
+    for (uint32_t idx = 0; idx < frontier.size(); idx++) {
+      thread_pool.enqueueTask([this, idx, &frontier, &offsets] {
+        const std::vector<BarnesHutNode> &subtree = subtrees[idx];
+        const int32_t offset = offsets[idx];
+        for (uint32_t local = 0; local < subtree.size(); local++) {
+          BarnesHutNode node = subtree[local];
+          if (node.first_child >= 0) {
+            node.first_child += offset;
+          }
+          nodes[local ? offset + local : frontier[idx]] = node;
+        }
+      });
+    }
+    thread_pool.completeAllTasks();
+
+    // Top-level children are always created after their parent, so a
+    // reverse sweep sees every child before it is summed.
+    for (int32_t node = static_cast<int32_t>(top_count) - 1; node >= 0;
+         node--) {
+      if (nodes[node].first_child >= 0 &&
+          nodes[node].first_child < static_cast<int32_t>(top_count)) {
+        sumChildren(nodes, node);
+      }
+    }
+  }
+
+  void evaluate(const std::vector<VerletObject> &objects, float strength,
+                float opening_angle) {
+    accelerations.resize(objects.size());
+    evaluateRange(objects, strength, opening_angle, 0, objects.size());
+  }
+
+  void evaluateThreaded(const std::vector<VerletObject> &objects,
+                        float strength, float opening_angle,
+                        tp::ThreadPool &thread_pool) {
+    accelerations.resize(objects.size());
+    thread_pool.dispatch(objects.size(), [&](uint32_t start, uint32_t end) {
+      evaluateRange(objects, strength, opening_angle, start, end);
+    });
+  }
+
+  sf::Vector2f getAcceleration(uint32_t idx) const {
+    return idx < accelerations.size() ? accelerations[idx]
+                                      : sf::Vector2f{0.0f, 0.0f};
+  }
+
+private:
+  std::vector<std::vector<BarnesHutNode>> subtrees;
+
+  static float getMass(const VerletObject &object) {
+    return object.radius * object.radius * object.radius;
+  }
+
+  // Sets up the root over a square bounding every massive object. Returns
+  // false if there is nothing to build.
+  bool initialise(const std::vector<VerletObject> &objects) {
+    nodes.clear();
+    order.clear();
+    sf::Vector2f min{INFINITY, INFINITY};
+    sf::Vector2f max{-INFINITY, -INFINITY};
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      const VerletObject &object = objects[idx];
+      if (!object.radius)
+        continue;
+      order.push_back(idx);
+      min = {std::min(min.x, object.curr_position.x),
+             std::min(min.y, object.curr_position.y)};
+      max = {std::max(max.x, object.curr_position.x),
+             std::max(max.y, object.curr_position.y)};
+    }
+    if (order.empty())
+      return false;
+    BarnesHutNode root;
+    root.centre = 0.5f * (min + max);
+    root.half_size = 0.5f * std::max(max.x - min.x, max.y - min.y) + 1.0f;
+    root.begin = 0;
+    root.end = order.size();
+    nodes.push_back(root);
+    return true;
+  }
+
+  // Splits a node into four children, or makes it a leaf and sums its mass.
+  // Returns whether it was split.
+  bool split(std::vector<BarnesHutNode> &tree, int32_t node, int32_t depth,
+             const std::vector<VerletObject> &objects) {
+    const BarnesHutNode parent = tree[node];
+    if (parent.end - parent.begin <= BARNES_HUT_LEAF_CAPACITY ||
+        depth >= BARNES_HUT_MAX_DEPTH) {
+      sumLeaf(tree[node], objects);
+      return false;
+    }
+    const auto below = [&](uint32_t idx) {
+      return objects[idx].curr_position.y < parent.centre.y;
+    };
+    const auto left = [&](uint32_t idx) {
+      return objects[idx].curr_position.x < parent.centre.x;
+    };
+    uint32_t *first = order.data() + parent.begin;
+    uint32_t *last = order.data() + parent.end;
+    uint32_t *middle = std::partition(first, last, below);
+    const uint32_t bounds[5] = {
+        parent.begin,
+        static_cast<uint32_t>(std::partition(first, middle, left) -
+                              order.data()),
+        static_cast<uint32_t>(middle - order.data()),
+        static_cast<uint32_t>(std::partition(middle, last, left) -
+                              order.data()),
+        parent.end};
+
+    const float quarter = 0.5f * parent.half_size;
+    tree[node].first_child = tree.size();
+    for (int32_t child = 0; child < 4; child++) {
+      BarnesHutNode quadrant;
+      quadrant.centre =
+          parent.centre + sf::Vector2f{child & 1 ? quarter : -quarter,
+                                       child & 2 ? quarter : -quarter};
+      quadrant.half_size = quarter;
+      quadrant.begin = bounds[child];
+      quadrant.end = bounds[child + 1];
+      tree.push_back(quadrant);
+    }
+    return true;
+  }
+
+  void buildSubtree(std::vector<BarnesHutNode> &tree, int32_t node,
+                    int32_t depth, const std::vector<VerletObject> &objects) {
+    if (!split(tree, node, depth, objects))
+      return;
+    for (int32_t child = 0; child < 4; child++) {
+      buildSubtree(tree, tree[node].first_child + child, depth + 1, objects);
+    }
+    sumChildren(tree, node);
+  }
+
+  void sumLeaf(BarnesHutNode &node,
+               const std::vector<VerletObject> &objects) const {
+    node.mass = 0.0f;
+    sf::Vector2f weighted{0.0f, 0.0f};
+    for (uint32_t idx = node.begin; idx < node.end; idx++) {
+      const VerletObject &object = objects[order[idx]];
+      const float mass = getMass(object);
+      node.mass += mass;
+      weighted += mass * object.curr_position;
+    }
+    node.mass_centre = node.mass ? weighted / node.mass : node.centre;
+  }
+
+  static void sumChildren(std::vector<BarnesHutNode> &tree, int32_t node) {
+    float mass = 0.0f;
+    sf::Vector2f weighted{0.0f, 0.0f};
+    for (int32_t child = 0; child < 4; child++) {
+      const BarnesHutNode &quadrant = tree[tree[node].first_child + child];
+      mass += quadrant.mass;
+      weighted += quadrant.mass * quadrant.mass_centre;
+    }
+    tree[node].mass = mass;
+    tree[node].mass_centre = mass ? weighted / mass : tree[node].centre;
+  }
+
+  void evaluateRange(const std::vector<VerletObject> &objects, float strength,
+                     float opening_angle, uint32_t start, uint32_t end) {
+    const float opening_squared = opening_angle * opening_angle;
+    const float softening_squared =
+        BARNES_HUT_SOFTENING * BARNES_HUT_SOFTENING;
+    int32_t stack[3 * BARNES_HUT_MAX_DEPTH + 4];
+    for (uint32_t idx = start; idx < end; idx++) {
+      const VerletObject &object = objects[idx];
+      sf::Vector2f acceleration{0.0f, 0.0f};
+      if (object.fixed || !object.radius || nodes.empty()) {
+        accelerations[idx] = acceleration;
+        continue;
+      }
+      const auto attract = [&](sf::Vector2f position, float mass) {
+        const sf::Vector2f displacement = position - object.curr_position;
+        const float square_distance = displacement.x * displacement.x +
+                                      displacement.y * displacement.y +
+                                      softening_squared;
+        acceleration += displacement * (mass / (square_distance *
+                                                std::sqrt(square_distance)));
+      };
+      int32_t stack_size = 0;
+      stack[stack_size++] = 0;
+      while (stack_size) {
+        const BarnesHutNode &node = nodes[stack[--stack_size]];
+        if (!node.mass)
+          continue;
+        if (node.first_child < 0) {
+          for (uint32_t k = node.begin; k < node.end; k++) {
+            if (order[k] != idx) {
+              const VerletObject &other = objects[order[k]];
+              attract(other.curr_position, getMass(other));
+            }
+          }
+          continue;
+        }
+        const sf::Vector2f displacement =
+            node.mass_centre - object.curr_position;
+        const float size = 2.0f * node.half_size;
+        if (size * size < opening_squared * (displacement.x * displacement.x +
+                                             displacement.y * displacement.y)) {
+          attract(node.mass_centre, node.mass);
+        } else {
+          for (int32_t child = 0; child < 4; child++) {
+            stack[stack_size++] = node.first_child + child;
+          }
+        }
+      }
+      accelerations[idx] = strength * acceleration;
+    }
+  }
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "verlet.hpp"
+
+constexpr float FORCE_FIELD_CELL_SIZE = 128.0f;
+constexpr float FORCE_FIELD_CORE_RADIUS = 20.0f;
+
+enum class ForceFieldType : uint8_t {
+  Point,  // Towards position; negative strength repels.
+  Vortex, // Around position; positive strength turns anticlockwise on screen.
+  Drag,   // Against each particle's velocity.
+  Wind,   // Along direction.
+};
+
+// How a bounded field weakens towards the edge of its radius. InverseSquare
+// is relative to FORCE_FIELD_CORE_RADIUS, so it also works unbounded.
+enum class Falloff : uint8_t {
+  Constant,
+  Linear,
+  Smooth,
+  InverseSquare,
+};
+
+// A radius of zero makes the field act everywhere; otherwise it only acts
+// on particles within radius of position.
+struct ForceField {
+  ForceFieldType type = ForceFieldType::Point;
+  sf::Vector2f position = {0.0f, 0.0f};
+  float radius = 0.0f;
+  float strength = 0.0f;
+  sf::Vector2f direction = {1.0f, 0.0f};
+  Falloff falloff = Falloff::Constant;
+  bool enabled = true;
+};
+
+// Fields are binned into a coarse grid whenever they change, so each
+// particle only evaluates the fields whose region overlaps its cell, plus
+// the unbounded ones. Ids stay valid until the field is removed.
+struct ForceFieldSet {
+  explicit ForceFieldSet(sf::Vector2f size)
+      : width{std::max(1, static_cast<int32_t>(
+                              std::ceil(size.x / FORCE_FIELD_CELL_SIZE)))},
+        height{std::max(1, static_cast<int32_t>(
+                               std::ceil(size.y / FORCE_FIELD_CELL_SIZE)))} {
+    rebuild();
+  }
+
+  uint32_t add(const ForceField &field) {
+    uint32_t id = fields.size();
+    if (!free_ids.empty()) {
+      id = free_ids.back();
+      free_ids.pop_back();
+      fields[id] = field;
+      in_use[id] = true;
+    } else {
+      fields.push_back(field);
+      in_use.push_back(true);
+    }
+    rebuild();
+    return id;
+  }
+
+  void remove(uint32_t id) {
+    if (id >= fields.size() || !in_use[id])
+      return;
+    in_use[id] = false;
+    free_ids.push_back(id);
+    rebuild();
+  }
+
+  void set(uint32_t id, const ForceField &field) {
+    if (id >= fields.size() || !in_use[id])
+      return;
+    fields[id] = field;
+    rebuild();
+  }
+
+  void setEnabled(uint32_t id, bool enabled) {
+    if (id >= fields.size() || !in_use[id] || fields[id].enabled == enabled)
+      return;
+    fields[id].enabled = enabled;
+    rebuild();
+  }
+
+  const ForceField &get(uint32_t id) const { return fields[id]; }
+
+  bool isInUse(uint32_t id) const { return id < fields.size() && in_use[id]; }
+
+  bool empty() const { return active_count == 0; }
+
+  sf::Vector2f getAcceleration(VerletObject &object, float dt) const {
+    sf::Vector2f acceleration{0.0f, 0.0f};
+    if (!active_count)
+      return acceleration;
+    const sf::Vector2f position = object.curr_position;
+    const int32_t x = std::min(std::max(getCellX(position.x), 0), width - 1);
+    const int32_t y = std::min(std::max(getCellY(position.y), 0), height - 1);
+    const int32_t cell = x * height + y;
+    for (uint32_t idx = cell_offsets[cell]; idx < cell_offsets[cell + 1];
+         idx++) {
+      acceleration += evaluate(fields[cell_fields[idx]], object, dt);
+    }
+    for (const uint32_t id : global_fields) {
+      acceleration += evaluate(fields[id], object, dt);
+    }
+    return acceleration;
+  }
+
+private:
+  int32_t width;
+  int32_t height;
+  std::vector<ForceField> fields;
+  std::vector<bool> in_use;
+  std::vector<uint32_t> free_ids;
+  uint32_t active_count = 0;
+  std::vector<uint32_t> global_fields;
+  std::vector<uint32_t> cell_offsets;
+  std::vector<uint32_t> cell_fields;
+
+  // Clamped to one cell beyond the grid before the cast, so positions far
+  // off the grid, or not a number, still convert.
+  int32_t getCellX(float x) const {
+    return static_cast<int32_t>(
+        std::min(std::max(-1.0f, std::floor(x / FORCE_FIELD_CELL_SIZE)),
+                 static_cast<float>(width)));
+  }
+
+  int32_t getCellY(float y) const {
+    return static_cast<int32_t>(
+        std::min(std::max(-1.0f, std::floor(y / FORCE_FIELD_CELL_SIZE)),
+                 static_cast<float>(height)));
+  }
+
+  static float getFalloff(Falloff falloff, float distance, float radius) {
+    switch (falloff) {
+    case Falloff::Linear:
+      return radius ? 1.0f - distance / radius : 1.0f;
+    case Falloff::Smooth: {
+      if (!radius)
+        return 1.0f;
+      const float t = distance / radius;
+      return (1.0f - t * t) * (1.0f - t * t);
+    }
+    case Falloff::InverseSquare: {
+      const float ratio =
+          FORCE_FIELD_CORE_RADIUS / std::max(distance, FORCE_FIELD_CORE_RADIUS);
+      return ratio * ratio;
+    }
+    default:
+      return 1.0f;
+    }
+  }
+
+  static sf::Vector2f evaluate(const ForceField &field, VerletObject &object,
+                               float dt) {
+    const sf::Vector2f displacement = field.position - object.curr_position;
+    const float square_distance =
+        displacement.x * displacement.x + displacement.y * displacement.y;
+    if (field.radius && square_distance >= field.radius * field.radius)
+      return {0.0f, 0.0f};
+    const float distance = std::sqrt(square_distance);
+    const float scale =
+        field.strength * getFalloff(field.falloff, distance, field.radius);
+    switch (field.type) {
+    case ForceFieldType::Point:
+      return distance > 0.0f ? displacement * (scale / distance)
+                             : sf::Vector2f{0.0f, 0.0f};
+    case ForceFieldType::Vortex:
+      return distance > 0.0f ? sf::Vector2f{-displacement.y, displacement.x} *
+                                   (scale / distance)
+                             : sf::Vector2f{0.0f, 0.0f};
+    case ForceFieldType::Drag:
+      return -scale * object.getVelocity(dt);
+    case ForceFieldType::Wind:
+      return scale * field.direction;
+    }
+    return {0.0f, 0.0f};
+  }
+
+  // Counts then fills a compressed list of field ids per cell, in id order,
+  // so every particle sums its fields in the same order.
+  void rebuild() {
+    active_count = 0;
+    global_fields.clear();
+    cell_offsets.assign(width * height + 1, 0);
+    const auto forEachCell = [&](const ForceField &field, auto &&callback) {
+      const int32_t min_x =
+          std::max(getCellX(field.position.x - field.radius), 0);
+      const int32_t max_x =
+          std::min(getCellX(field.position.x + field.radius), width - 1);
+      const int32_t min_y =
+          std::max(getCellY(field.position.y - field.radius), 0);
+      const int32_t max_y =
+          std::min(getCellY(field.position.y + field.radius), height - 1);
+      for (int32_t x = min_x; x <= max_x; x++) {
+        for (int32_t y = min_y; y <= max_y; y++) {
+          callback(x * height + y);
+        }
+      }
+    };
+    for (uint32_t id = 0; id < fields.size(); id++) {
+      if (!in_use[id] || !fields[id].enabled)
+        continue;
+      active_count++;
+      if (!fields[id].radius) {
+        global_fields.push_back(id);
+        continue;
+      }
+      forEachCell(fields[id], [&](int32_t cell) { cell_offsets[cell + 1]++; });
+    }
+    for (uint32_t cell = 0; cell < width * height; cell++) {
+      cell_offsets[cell + 1] += cell_offsets[cell];
+    }
+    cell_fields.resize(cell_offsets.back());
+    std::vector<uint32_t> cursor(cell_offsets.begin(), cell_offsets.end() - 1);
+    for (uint32_t id = 0; id < fields.size(); id++) {
+      if (!in_use[id] || !fields[id].enabled || !fields[id].radius)
+        continue;
+      forEachCell(fields[id],
+                  [&](int32_t cell) { cell_fields[cursor[cell]++] = id; });
+    }
+  }
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "rope-solver.hpp"
+#include "verlet.hpp"
+
+// The kinds of work in an island, in the order the solver runs them.
+enum class IslandWork : uint8_t {
+  Chain,
+  Constraint,
+  SoftBody,
+  RigidBody,
+  Count,
+};
+
+// Splits the particles coupled by constraints or bodies into connected
+// components. Work in different islands touches disjoint particles, so the
+// islands can be solved in any order, or at the same time, with the same
+// result as solving each kind of work for every island in turn.
+struct IslandSet {
+  void build(const std::vector<VerletObject> &objects,
+             const std::vector<VerletConstraint> &constraints,
+             const std::vector<VerletSoftBody> &soft_bodies,
+             const std::vector<VerletRigidBody> &rigid_bodies,
+             const RopeSolver &ropes) {
+    const VerletObject *base = objects.data();
+    parents.resize(objects.size());
+    std::iota(parents.begin(), parents.end(), 0u);
+    coupled.assign(objects.size(), 0);
+    const auto join = [&](uint32_t object_1, uint32_t object_2) {
+      coupled[object_1] = coupled[object_2] = 1;
+      parents[find(object_1)] = find(object_2);
+    };
+    for (const VerletConstraint &constraint : constraints) {
+      join(&constraint.object_1 - base, &constraint.object_2 - base);
+    }
+    const auto joinAll = [&](const std::vector<VerletObject *> &vertices) {
+      for (const VerletObject *vertex : vertices) {
+        join(vertices[0] - base, vertex - base);
+      }
+    };
+    for (const VerletSoftBody &soft_body : soft_bodies) {
+      joinAll(soft_body.vertices);
+    }
+    for (const VerletRigidBody &rigid_body : rigid_bodies) {
+      joinAll(rigid_body.vertices);
+    }
+
+    std::vector<uint32_t> island_of(objects.size(), UINT32_MAX);
+    uint32_t island_count = 0;
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      if (coupled[idx] && island_of[find(idx)] == UINT32_MAX) {
+        island_of[find(idx)] = island_count++;
+      }
+    }
+    const auto islandOf = [&](uint32_t object) {
+      return island_of[find(object)];
+    };
+
+    // Counting sort of the work items and objects by island, then by kind.
+    constexpr uint32_t KINDS = static_cast<uint32_t>(IslandWork::Count);
+    work_offsets.assign(island_count * KINDS + 1, 0);
+    object_offsets.assign(island_count + 1, 0);
+    const auto forEachItem = [&](auto &&callback) {
+      for (uint32_t chain = 0; chain < ropes.getChainCount(); chain++) {
+        callback(islandOf(ropes.getChainStart(chain)), IslandWork::Chain,
+                 chain);
+      }
+      for (uint32_t idx = 0; idx < constraints.size(); idx++) {
+        if (!constraints[idx].in_chain) {
+          callback(islandOf(&constraints[idx].object_1 - base),
+                   IslandWork::Constraint, idx);
+        }
+      }
+      for (uint32_t idx = 0; idx < soft_bodies.size(); idx++) {
+        if (!soft_bodies[idx].vertices.empty()) {
+          callback(islandOf(soft_bodies[idx].vertices[0] - base),
+                   IslandWork::SoftBody, idx);
+        }
+      }
+      for (uint32_t idx = 0; idx < rigid_bodies.size(); idx++) {
+        if (!rigid_bodies[idx].vertices.empty()) {
+          callback(islandOf(rigid_bodies[idx].vertices[0] - base),
+                   IslandWork::RigidBody, idx);
+        }
+      }
+    };
+    forEachItem([&](uint32_t island, IslandWork kind, uint32_t) {
+      work_offsets[island * KINDS + static_cast<uint32_t>(kind) + 1]++;
+    });
+    for (uint32_t idx = 0; idx + 1 < work_offsets.size(); idx++) {
+      work_offsets[idx + 1] += work_offsets[idx];
+    }
+    work.resize(work_offsets.back());
+    std::vector<uint32_t> cursor(work_offsets.begin(), work_offsets.end() - 1);
+    forEachItem([&](uint32_t island, IslandWork kind, uint32_t item) {
+      work[cursor[island * KINDS + static_cast<uint32_t>(kind)]++] = item;
+    });
+
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      if (coupled[idx]) {
+        object_offsets[islandOf(idx) + 1]++;
+      }
+    }
+    for (uint32_t island = 0; island < island_count; island++) {
+      object_offsets[island + 1] += object_offsets[island];
+    }
+    island_objects.resize(object_offsets.back());
+    cursor.assign(object_offsets.begin(), object_offsets.end() - 1);
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      if (coupled[idx]) {
+        island_objects[cursor[islandOf(idx)]++] = idx;
+      }
+    }
+  }
+
+  uint32_t getIslandCount() const { return object_offsets.size() - 1; }
+
+  // The indices of one kind of work in an island, in ascending order.
+  const uint32_t *beginWork(uint32_t island, IslandWork kind) const {
+    return work.data() + work_offsets[getSlot(island, kind)];
+  }
+
+  const uint32_t *endWork(uint32_t island, IslandWork kind) const {
+    return work.data() + work_offsets[getSlot(island, kind) + 1];
+  }
+
+  const uint32_t *beginObjects(uint32_t island) const {
+    return island_objects.data() + object_offsets[island];
+  }
+
+  const uint32_t *endObjects(uint32_t island) const {
+    return island_objects.data() + object_offsets[island + 1];
+  }
+
+  // Objects added since the last build are never coupled.
+  bool isCoupled(uint32_t object) const {
+    return object < coupled.size() && coupled[object];
+  }
+
+private:
+  std::vector<uint32_t> parents;
+  std::vector<uint8_t> coupled;
+  // Work of kind k in island i is work[work_offsets[i * KINDS + k],
+  // work_offsets[i * KINDS + k + 1]); objects follow the same layout by
+  // island alone.
+  std::vector<uint32_t> work_offsets{0u};
+  std::vector<uint32_t> work;
+  std::vector<uint32_t> object_offsets{0u};
+  std::vector<uint32_t> island_objects;
+
+  static uint32_t getSlot(uint32_t island, IslandWork kind) {
+    return island * static_cast<uint32_t>(IslandWork::Count) +
+           static_cast<uint32_t>(kind);
+  }
+
+  uint32_t find(uint32_t object) {
+    while (parents[object] != object) {
+      parents[object] = parents[parents[object]];
+      object = parents[object];
+    }
+    return object;
+  }
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "verlet.hpp"
+
+constexpr int32_t DETAIL_BLOCK_CELLS = 8;
+constexpr float DEFAULT_REST_SPEED = 20.0f;
+
+// A box, in pixels, inside which everything steps at the full rate.
+struct DetailRegion {
+  sf::Vector2f min = {0.0f, 0.0f};
+  sf::Vector2f max = {0.0f, 0.0f};
+};
+
+// Decides once per frame how often each particle steps. The world is split
+// into square blocks of DETAIL_BLOCK_CELLS collision cells a side. Blocks
+// that overlap a detail region, or hold a particle moving faster than the
+// rest speed, step every substep, as do the blocks around them, so the
+// boundary between rates stays a block away from anything that matters.
+// Particles in every other block step once every coarse interval substeps,
+// with a step that many times longer. Ids stay valid until the region is
+// removed.
+struct DetailMap {
+  DetailMap(sf::Vector2f size, float cell_size)
+      : block_size{DETAIL_BLOCK_CELLS * cell_size},
+        width{std::max(1, static_cast<int32_t>(
+                              std::ceil(size.x / block_size)))},
+        height{std::max(1, static_cast<int32_t>(
+                               std::ceil(size.y / block_size)))} {}
+
+  uint32_t addRegion(const DetailRegion &region) {
+    uint32_t id = regions.size();
+    if (!free_ids.empty()) {
+      id = free_ids.back();
+      free_ids.pop_back();
+      regions[id] = region;
+      in_use[id] = true;
+    } else {
+      regions.push_back(region);
+      in_use.push_back(true);
+    }
+    return id;
+  }
+
+  // Moving a region every frame, to follow a camera, is cheap: regions are
+  // only looked at when intervals are assigned.
+  void setRegion(uint32_t id, const DetailRegion &region) {
+    if (id >= regions.size() || !in_use[id])
+      return;
+    regions[id] = region;
+  }
+
+  void removeRegion(uint32_t id) {
+    if (id >= regions.size() || !in_use[id])
+      return;
+    in_use[id] = false;
+    free_ids.push_back(id);
+  }
+
+  // An interval of one steps everything every substep. A rest speed of zero
+  // leaves only the regions at the full rate.
+  void setCoarseInterval(uint32_t interval, float rest_speed) {
+    coarse_interval = std::max(interval, 1u);
+    square_rest_speed = rest_speed * rest_speed;
+  }
+
+  uint32_t getCoarseInterval() const { return coarse_interval; }
+
+  bool isEnabled() const { return coarse_interval > 1; }
+
+  // Gives every object its interval for the coming frame, with
+  // is_coupled(idx) naming the objects that must step every substep. A
+  // coarse object's last_position is moved back so that it is an interval
+  // behind instead of one substep, keeping its velocity; its last step of
+  // the frame undoes this (see Solver::updateObject).
+  template <typename CoupledCallback>
+  void assign(std::vector<VerletObject> &objects, float step_dt,
+              CoupledCallback &&is_coupled) {
+    coarse_count = 0;
+    if (!isEnabled()) {
+      intervals.clear();
+      return;
+    }
+    fine_blocks.assign(width * height, 0);
+    for (uint32_t id = 0; id < regions.size(); id++) {
+      if (!in_use[id])
+        continue;
+      const int32_t min_x = std::max(getBlockX(regions[id].min.x), 0);
+      const int32_t max_x = std::min(getBlockX(regions[id].max.x), width - 1);
+      const int32_t min_y = std::max(getBlockY(regions[id].min.y), 0);
+      const int32_t max_y = std::min(getBlockY(regions[id].max.y), height - 1);
+      for (int32_t x = min_x; x <= max_x; x++) {
+        for (int32_t y = min_y; y <= max_y; y++) {
+          fine_blocks[x * height + y] = 1;
+        }
+      }
+    }
+    if (square_rest_speed > 0.0f) {
+      const float square_step_dt = step_dt * step_dt;
+      for (const VerletObject &object : objects) {
+        if (object.fixed)
+          continue;
+        const sf::Vector2f displacement =
+            object.curr_position - object.last_position;
+        if (displacement.x * displacement.x + displacement.y * displacement.y >
+            square_rest_speed * square_step_dt) {
+          fine_blocks[getBlock(object.curr_position)] = 1;
+        }
+      }
+    }
+
+    block_intervals.assign(width * height, coarse_interval);
+    for (int32_t x = 0; x < width; x++) {
+      for (int32_t y = 0; y < height; y++) {
+        if (!fine_blocks[x * height + y])
+          continue;
+        for (int32_t dx = std::max(x - 1, 0); dx <= std::min(x + 1, width - 1);
+             dx++) {
+          for (int32_t dy = std::max(y - 1, 0);
+               dy <= std::min(y + 1, height - 1); dy++) {
+            block_intervals[dx * height + dy] = 1;
+          }
+        }
+      }
+    }
+
+    intervals.resize(objects.size());
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      VerletObject &object = objects[idx];
+      const uint32_t interval =
+          is_coupled(idx) ? 1 : block_intervals[getBlock(object.curr_position)];
+      intervals[idx] = interval;
+      if (interval > 1) {
+        object.last_position =
+            object.curr_position -
+            (object.curr_position - object.last_position) *
+                static_cast<float>(interval);
+        coarse_count++;
+      }
+    }
+  }
+
+  // Substeps between the object's steps this frame.
+  uint32_t getInterval(uint32_t object) const {
+    return object < intervals.size() ? intervals[object] : 1;
+  }
+
+  // Whether the object steps on the given substep of the frame, counting
+  // from zero.
+  bool isActive(uint32_t object, int32_t substep) const {
+    return object >= intervals.size() ||
+           (substep + 1) % intervals[object] == 0;
+  }
+
+  // Objects stepping at the coarse interval this frame.
+  uint32_t getCoarseCount() const { return coarse_count; }
+
+private:
+  float block_size;
+  int32_t width;
+  int32_t height;
+  std::vector<DetailRegion> regions;
+  std::vector<bool> in_use;
+  std::vector<uint32_t> free_ids;
+  uint32_t coarse_interval = 1;
+  float square_rest_speed = DEFAULT_REST_SPEED * DEFAULT_REST_SPEED;
+  uint32_t coarse_count = 0;
+  std::vector<uint8_t> fine_blocks;
+  std::vector<uint32_t> block_intervals;
+  std::vector<uint32_t> intervals;
+
+  // Clamped to one block beyond the map, so far off regions still convert.
+  int32_t getBlockX(float x) const {
+    return static_cast<int32_t>(
+        std::min(std::max(std::floor(x / block_size), -1.0f),
+                 static_cast<float>(width)));
+  }
+
+  int32_t getBlockY(float y) const {
+    return static_cast<int32_t>(
+        std::min(std::max(std::floor(y / block_size), -1.0f),
+                 static_cast<float>(height)));
+  }
+
+  int32_t getBlock(sf::Vector2f position) const {
+    const int32_t x = std::min(std::max(getBlockX(position.x), 0), width - 1);
+    const int32_t y = std::min(std::max(getBlockY(position.y), 0), height - 1);
+    return x * height + y;
+  }
+};
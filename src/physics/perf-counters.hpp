@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#if defined(SOLVER_PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+constexpr bool PERF_COUNTERS_ENABLED = true;
+#else
+constexpr bool PERF_COUNTERS_ENABLED = false;
+#endif
+
+enum class HardwareCounter : uint8_t {
+  Cycles,
+  Instructions,
+  CacheMisses,
+  BranchMisses,
+  Count
+};
+
+constexpr int32_t HARDWARE_COUNTER_COUNT =
+    static_cast<int32_t>(HardwareCounter::Count);
+
+constexpr const char *HARDWARE_COUNTER_NAMES[HARDWARE_COUNTER_COUNT] = {
+    "cycles", "instructions", "llc_misses", "branch_misses"};
+
+struct CounterValues {
+  std::array<uint64_t, HARDWARE_COUNTER_COUNT> values{};
+
+  uint64_t operator[](HardwareCounter counter) const {
+    return values[static_cast<int32_t>(counter)];
+  }
+
+  CounterValues &operator+=(const CounterValues &other) {
+    for (int32_t idx = 0; idx < HARDWARE_COUNTER_COUNT; idx++) {
+      values[idx] += other.values[idx];
+    }
+    return *this;
+  }
+
+  CounterValues operator-(const CounterValues &other) const {
+    CounterValues difference;
+    for (int32_t idx = 0; idx < HARDWARE_COUNTER_COUNT; idx++) {
+      difference.values[idx] = values[idx] - other.values[idx];
+    }
+    return difference;
+  }
+};
+
+// One counter group per thread, counting user-space events of the calling
+// thread only; it is opened lazily the first time that thread reads it.
+// Without permission to open counters (see perf_event_paranoid) every read
+// returns zeros rather than failing.
+struct PerfCounterGroup {
+  PerfCounterGroup() {
+#if defined(SOLVER_PERF_COUNTERS) && defined(__linux__)
+    constexpr uint64_t configs[HARDWARE_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int32_t idx = 0; idx < HARDWARE_COUNTER_COUNT; idx++) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[idx];
+      attr.disabled = idx == 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      fds[idx] = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, idx ? fds[0] : -1, 0));
+      if (fds[idx] < 0) {
+        closeAll();
+        return;
+      }
+    }
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    available = true;
+#endif
+  }
+
+  PerfCounterGroup(const PerfCounterGroup &) = delete;
+  PerfCounterGroup &operator=(const PerfCounterGroup &) = delete;
+
+  ~PerfCounterGroup() { closeAll(); }
+
+  static PerfCounterGroup &thisThread() {
+    thread_local PerfCounterGroup group;
+    return group;
+  }
+
+  bool isAvailable() const { return available; }
+
+  CounterValues read() const {
+    CounterValues counters;
+#if defined(SOLVER_PERF_COUNTERS) && defined(__linux__)
+    if (!available)
+      return counters;
+    struct {
+      uint64_t count;
+      uint64_t values[HARDWARE_COUNTER_COUNT];
+    } group_data;
+    if (::read(fds[0], &group_data, sizeof(group_data)) ==
+        sizeof(group_data)) {
+      for (int32_t idx = 0; idx < HARDWARE_COUNTER_COUNT; idx++) {
+        counters.values[idx] = group_data.values[idx];
+      }
+    }
+#endif
+    return counters;
+  }
+
+private:
+  std::array<int, HARDWARE_COUNTER_COUNT> fds{-1, -1, -1, -1};
+  bool available = false;
+
+  void closeAll() {
+#if defined(SOLVER_PERF_COUNTERS) && defined(__linux__)
+    for (int &fd : fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      fd = -1;
+    }
+#endif
+    available = false;
+  }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../thread_pool/thread_pool.hpp"
+#include "perf-counters.hpp"
+
+#if defined(SOLVER_INSTRUMENTATION) || defined(SOLVER_PERF_COUNTERS)
+constexpr bool INSTRUMENTATION_ENABLED = true;
+#else
+constexpr bool INSTRUMENTATION_ENABLED = false;
+#endif
+
+constexpr uint32_t MAX_PROFILE_EVENTS = 1 << 20;
+
+enum class SolverPhase : uint8_t {
+  Grid,
+  Collisions,
+  Constraints,
+  SoftBodies,
+  Integration,
+  LongRange,
+  RigidBodies,
+  Count
+};
+
+constexpr int32_t SOLVER_PHASE_COUNT = static_cast<int32_t>(SolverPhase::Count);
+
+constexpr const char *SOLVER_PHASE_NAMES[SOLVER_PHASE_COUNT] = {
+    "grid",        "collisions", "constraints",  "soft_bodies",
+    "integration", "long_range", "rigid_bodies"};
+
+using PhaseTimes = std::array<int64_t, SOLVER_PHASE_COUNT>;
+using PhaseCounters = std::array<CounterValues, SOLVER_PHASE_COUNT>;
+
+struct SolverCounters {
+  uint64_t candidate_pairs = 0;
+  uint64_t contacts = 0;
+  uint64_t cell_overflows = 0;
+  uint64_t constraint_iterations = 0;
+
+  SolverCounters &operator+=(const SolverCounters &other) {
+    candidate_pairs += other.candidate_pairs;
+    contacts += other.contacts;
+    cell_overflows += other.cell_overflows;
+    constraint_iterations += other.constraint_iterations;
+    return *this;
+  }
+};
+
+// worker is -1 for phase spans on the thread driving the solver, otherwise
+// the profiler slot that ran the task (0 is the driving thread itself).
+struct PhaseEvent {
+  SolverPhase phase;
+  int32_t worker;
+  int32_t substep;
+  int32_t partition;
+  int64_t start_ns;
+  int64_t duration_ns;
+};
+
+struct SolverStats {
+  uint64_t frames = 0;
+  uint64_t substeps = 0;
+  PhaseTimes phase_ns{};
+  std::vector<PhaseTimes> substep_phase_ns;
+  std::vector<PhaseTimes> worker_phase_ns;
+  std::vector<int64_t> partition_ns;
+  SolverCounters counters;
+  PhaseCounters phase_hardware{};
+  std::vector<PhaseCounters> worker_hardware;
+  std::vector<PhaseEvent> events;
+};
+
+// Every thread writes only to its own cache-line-aligned slot, so recording
+// from inside pool tasks needs no synchronisation; slots are merged on query.
+struct SolverProfiler {
+  struct alignas(64) Slot {
+    PhaseTimes phase_ns{};
+    std::vector<int64_t> partition_ns;
+    SolverCounters counters;
+    PhaseCounters hardware{};
+    std::vector<PhaseEvent> events;
+  };
+
+  // A span is a whole phase timed on the driving thread; a task is one piece
+  // of work timed on whichever thread ran it. Phases that are not split into
+  // pool tasks are both. Hardware counters are only read around tasks, so
+  // per-thread totals never count the same work twice.
+  struct Scope {
+    SolverProfiler *profiler = nullptr;
+    SolverPhase phase;
+    int32_t partition;
+    bool span;
+    bool task;
+    int64_t start_ns;
+    CounterValues start_counters;
+
+    Scope(SolverProfiler *profiler, SolverPhase phase, int32_t partition,
+          bool span, bool task)
+        : profiler{profiler}, phase{phase}, partition{partition}, span{span},
+          task{task} {
+      if constexpr (PERF_COUNTERS_ENABLED) {
+        if (task) {
+          start_counters = PerfCounterGroup::thisThread().read();
+        }
+      }
+      if constexpr (INSTRUMENTATION_ENABLED) {
+        start_ns = profiler->now();
+      }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+    ~Scope() {
+      if constexpr (INSTRUMENTATION_ENABLED) {
+        const int64_t end_ns = profiler->now();
+        if (span) {
+          profiler->recordSpan(phase, start_ns, end_ns);
+        }
+        if (task) {
+          profiler->recordTask(phase, partition, start_ns, end_ns);
+        }
+      }
+      if constexpr (PERF_COUNTERS_ENABLED) {
+        if (task) {
+          profiler->slot().hardware[static_cast<int32_t>(phase)] +=
+              PerfCounterGroup::thisThread().read() - start_counters;
+        }
+      }
+    }
+  };
+
+  explicit SolverProfiler(uint32_t thread_count)
+      : slots(INSTRUMENTATION_ENABLED ? thread_count + 1 : 0),
+        epoch{std::chrono::steady_clock::now()} {}
+
+  Scope phase(SolverPhase phase) {
+    return Scope{this, phase, -1, true, false};
+  }
+
+  Scope task(SolverPhase phase, int32_t partition = -1) {
+    return Scope{this, phase, partition, false, true};
+  }
+
+  Scope serial(SolverPhase phase) {
+    return Scope{this, phase, -1, true, true};
+  }
+
+  void beginFrame() {
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      frames++;
+    }
+  }
+
+  void beginSubstep(int32_t index) {
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      substep = index;
+      substeps++;
+      if (substep_phase_ns.size() <= index) {
+        substep_phase_ns.resize(index + 1);
+      }
+    }
+  }
+
+  void countCandidates(uint32_t count) {
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      slot().counters.candidate_pairs += count;
+    }
+  }
+
+  void countContact() {
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      slot().counters.contacts++;
+    }
+  }
+
+  void countCellOverflow() {
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      slot().counters.cell_overflows++;
+    }
+  }
+
+  void countConstraintIterations(uint32_t count) {
+    if constexpr (INSTRUMENTATION_ENABLED) {
+      slot().counters.constraint_iterations += count;
+    }
+  }
+
+  void reset() {
+    for (auto &profile_slot : slots) {
+      profile_slot = Slot{};
+    }
+    frames = 0;
+    substeps = 0;
+    phase_ns = {};
+    substep_phase_ns.clear();
+    phase_events.clear();
+  }
+
+  SolverStats getStats() const {
+    SolverStats stats;
+    stats.frames = frames;
+    stats.substeps = substeps;
+    stats.phase_ns = phase_ns;
+    stats.substep_phase_ns = substep_phase_ns;
+    stats.events = phase_events;
+    for (const auto &profile_slot : slots) {
+      stats.worker_phase_ns.push_back(profile_slot.phase_ns);
+      stats.counters += profile_slot.counters;
+      stats.worker_hardware.push_back(profile_slot.hardware);
+      for (int32_t phase = 0; phase < SOLVER_PHASE_COUNT; phase++) {
+        stats.phase_hardware[phase] += profile_slot.hardware[phase];
+      }
+      if (stats.partition_ns.size() < profile_slot.partition_ns.size()) {
+        stats.partition_ns.resize(profile_slot.partition_ns.size());
+      }
+      for (uint32_t idx = 0; idx < profile_slot.partition_ns.size(); idx++) {
+        stats.partition_ns[idx] += profile_slot.partition_ns[idx];
+      }
+      stats.events.insert(stats.events.end(), profile_slot.events.begin(),
+                          profile_slot.events.end());
+    }
+    return stats;
+  }
+
+  // Writes the Trace Event Format understood by chrome://tracing and
+  // Perfetto: one track for the phase spans, one per worker for tasks.
+  void writeChromeTrace(std::ostream &out) const {
+    const SolverStats stats = getStats();
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto &event : stats.events) {
+      out << (first ? "" : ",") << "{\"name\":\""
+          << SOLVER_PHASE_NAMES[static_cast<int32_t>(event.phase)]
+          << "\",\"cat\":\"solver\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+          << event.worker + 1 << ",\"ts\":";
+      writeMicroseconds(out, event.start_ns);
+      out << ",\"dur\":";
+      writeMicroseconds(out, event.duration_ns);
+      out << ",\"args\":{\"substep\":" << event.substep
+          << ",\"partition\":" << event.partition << "}}";
+      first = false;
+    }
+    for (int32_t tid = 0; tid <= static_cast<int32_t>(slots.size()); tid++) {
+      out << (first ? "" : ",")
+          << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+          << ",\"args\":{\"name\":\""
+          << (tid == 0   ? "phases"
+              : tid == 1 ? "main"
+                         : "worker " + std::to_string(tid - 2))
+          << "\"}}";
+      first = false;
+    }
+    out << "],\"otherData\":{\"candidate_pairs\":"
+        << stats.counters.candidate_pairs
+        << ",\"contacts\":" << stats.counters.contacts
+        << ",\"cell_overflows\":" << stats.counters.cell_overflows
+        << ",\"constraint_iterations\":"
+        << stats.counters.constraint_iterations << "}}";
+  }
+
+private:
+  std::vector<Slot> slots;
+  std::chrono::steady_clock::time_point epoch;
+  uint64_t frames = 0;
+  uint64_t substeps = 0;
+  int32_t substep = 0;
+  PhaseTimes phase_ns{};
+  std::vector<PhaseTimes> substep_phase_ns;
+  std::vector<PhaseEvent> phase_events;
+
+  // Exact to the nanosecond however long the run: streamed as a double,
+  // timestamps keep six significant digits and late events collapse.
+  static void writeMicroseconds(std::ostream &out, int64_t ns) {
+    const int64_t fraction = ns % 1000;
+    out << ns / 1000 << '.' << fraction / 100 << fraction / 10 % 10
+        << fraction % 10;
+  }
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+  }
+
+  Slot &slot() { return slots[tp::this_worker_id + 1]; }
+
+  void recordSpan(SolverPhase phase, int64_t start_ns, int64_t end_ns) {
+    const int32_t phase_idx = static_cast<int32_t>(phase);
+    const int64_t duration_ns = end_ns - start_ns;
+    phase_ns[phase_idx] += duration_ns;
+    substep_phase_ns[substep][phase_idx] += duration_ns;
+    if (phase_events.size() < MAX_PROFILE_EVENTS) {
+      phase_events.push_back({phase, -1, substep, -1, start_ns, duration_ns});
+    }
+  }
+
+  void recordTask(SolverPhase phase, int32_t partition, int64_t start_ns,
+                  int64_t end_ns) {
+    const int32_t phase_idx = static_cast<int32_t>(phase);
+    const int64_t duration_ns = end_ns - start_ns;
+    Slot &profile_slot = slot();
+    profile_slot.phase_ns[phase_idx] += duration_ns;
+    if (partition >= 0) {
+      if (profile_slot.partition_ns.size() <= partition) {
+        profile_slot.partition_ns.resize(partition + 1);
+      }
+      profile_slot.partition_ns[partition] += duration_ns;
+    }
+    if (profile_slot.events.size() < MAX_PROFILE_EVENTS) {
+      profile_slot.events.push_back({phase, tp::this_worker_id + 1, substep,
+                                     partition, start_ns, duration_ns});
+    }
+  }
+};
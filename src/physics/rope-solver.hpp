@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "verlet.hpp"
+
+constexpr int32_t ROPE_NEWTON_ITERATIONS = 2;
+
+// Solves open chains of distance constraints directly instead of by
+// Gauss-Seidel sweeps. For a chain, the linearised system for the constraint
+// multipliers is tridiagonal, so each Newton iteration is one Thomas
+// algorithm pass, linear in the chain length, and corrects every segment of
+// the chain at once. Particles have unit inverse mass, or zero when fixed,
+// which matches the even split VerletConstraint::apply makes.
+struct RopeSolver {
+  // Finds every connected run of rigid constraints whose particles have at
+  // most two constraints each and which has two free-standing ends, i.e.
+  // every rope, and marks those constraints in_chain. Rings (soft bodies),
+  // compliant chains and anything attached to a junction are left to
+  // Gauss-Seidel.
+  void detect(const std::vector<VerletObject> &objects,
+              std::vector<VerletConstraint> &constraints) {
+    chain_offsets.assign(1, 0u);
+    chain_objects.clear();
+    chain_lengths.clear();
+    chained_constraint_count = 0;
+
+    const VerletObject *base = objects.data();
+    std::vector<Link> links(2 * objects.size());
+    std::vector<uint8_t> degree(objects.size(), 0);
+    for (uint32_t idx = 0; idx < constraints.size(); idx++) {
+      VerletConstraint &constraint = constraints[idx];
+      constraint.in_chain = false;
+      const uint32_t object_1 = &constraint.object_1 - base;
+      const uint32_t object_2 = &constraint.object_2 - base;
+      if (degree[object_1] < 2)
+        links[2 * object_1 + degree[object_1]] = {object_2, idx};
+      if (degree[object_2] < 2)
+        links[2 * object_2 + degree[object_2]] = {object_1, idx};
+      degree[object_1] = std::min(degree[object_1] + 1, 3);
+      degree[object_2] = std::min(degree[object_2] + 1, 3);
+    }
+
+    std::vector<bool> visited(objects.size(), false);
+    std::vector<uint32_t> chain_constraints;
+    for (uint32_t start = 0; start < objects.size(); start++) {
+      if (degree[start] != 1 || visited[start])
+        continue;
+      chain_constraints.clear();
+      const uint32_t first_object = chain_objects.size();
+      uint32_t current = start;
+      uint32_t previous_constraint = UINT32_MAX;
+      bool valid = true;
+      while (true) {
+        visited[current] = true;
+        chain_objects.push_back(current);
+        if (degree[current] > 2) {
+          valid = false;
+          break;
+        }
+        const Link *next = nullptr;
+        for (uint32_t k = 0; k < degree[current]; k++) {
+          if (links[2 * current + k].constraint != previous_constraint) {
+            next = &links[2 * current + k];
+          }
+        }
+        if (!next)
+          break;
+        chain_constraints.push_back(next->constraint);
+        previous_constraint = next->constraint;
+        current = next->object;
+      }
+      if (!valid) {
+        chain_objects.resize(first_object);
+        continue;
+      }
+      for (const uint32_t idx : chain_constraints) {
+        valid = valid && !constraints[idx].compliance;
+      }
+      if (!valid) {
+        chain_objects.resize(first_object);
+        continue;
+      }
+      for (const uint32_t idx : chain_constraints) {
+        constraints[idx].in_chain = true;
+        chain_lengths.push_back(constraints[idx].target_distance);
+      }
+      chained_constraint_count += chain_constraints.size();
+      chain_offsets.push_back(chain_objects.size());
+    }
+  }
+
+  uint32_t getChainCount() const { return chain_offsets.size() - 1; }
+
+  uint32_t getChainedConstraintCount() const {
+    return chained_constraint_count;
+  }
+
+  // The first object of a chain, which identifies the chain's island.
+  uint32_t getChainStart(uint32_t chain) const {
+    return chain_objects[chain_offsets[chain]];
+  }
+
+  void solve(std::vector<VerletObject> &objects) {
+    for (uint32_t chain = 0; chain < getChainCount(); chain++) {
+      solveChain(objects, chain);
+    }
+  }
+
+  // Chains share no objects, so different chains can be solved at once.
+  void solveChain(std::vector<VerletObject> &objects, uint32_t chain) const {
+    static thread_local std::vector<sf::Vector2f> normals;
+    static thread_local std::vector<float> diagonal;
+    static thread_local std::vector<float> upper;
+    static thread_local std::vector<float> rhs;
+    static thread_local std::vector<float> lambda;
+    const uint32_t *indices = &chain_objects[chain_offsets[chain]];
+    const float *lengths = &chain_lengths[chain_offsets[chain] - chain];
+    const uint32_t segments =
+        chain_offsets[chain + 1] - chain_offsets[chain] - 1;
+    normals.resize(segments);
+    diagonal.resize(segments);
+    upper.resize(segments);
+    rhs.resize(segments);
+    lambda.resize(segments);
+    const auto weight = [&](uint32_t k) {
+      return objects[indices[k]].fixed ? 0.0f : 1.0f;
+    };
+
+    for (int32_t iteration = 0; iteration < ROPE_NEWTON_ITERATIONS;
+         iteration++) {
+      for (uint32_t i = 0; i < segments; i++) {
+        const sf::Vector2f displacement =
+            objects[indices[i + 1]].curr_position -
+            objects[indices[i]].curr_position;
+        const float distance = std::sqrt(displacement.x * displacement.x +
+                                         displacement.y * displacement.y);
+        normals[i] = distance > 0.0f ? displacement / distance
+                                     : sf::Vector2f{0.0f, 1.0f};
+        rhs[i] = lengths[i] - distance;
+        diagonal[i] = weight(i) + weight(i + 1);
+        if (!diagonal[i]) {
+          diagonal[i] = 1.0f;
+          rhs[i] = 0.0f;
+        }
+      }
+      for (uint32_t i = 0; i + 1 < segments; i++) {
+        upper[i] = -weight(i + 1) * (normals[i].x * normals[i + 1].x +
+                                     normals[i].y * normals[i + 1].y);
+      }
+
+      // Thomas algorithm: forward elimination, then back substitution.
+      for (uint32_t i = 1; i < segments; i++) {
+        const float factor = upper[i - 1] / diagonal[i - 1];
+        diagonal[i] -= factor * upper[i - 1];
+        rhs[i] -= factor * rhs[i - 1];
+      }
+      for (uint32_t i = segments; i-- > 0;) {
+        const float coupling =
+            i + 1 < segments ? upper[i] * lambda[i + 1] : 0.0f;
+        lambda[i] = (rhs[i] - coupling) / diagonal[i];
+      }
+
+      for (uint32_t k = 0; k <= segments; k++) {
+        const float w = weight(k);
+        if (!w)
+          continue;
+        sf::Vector2f correction{0.0f, 0.0f};
+        if (k > 0)
+          correction += lambda[k - 1] * normals[k - 1];
+        if (k < segments)
+          correction -= lambda[k] * normals[k];
+        objects[indices[k]].curr_position += w * correction;
+      }
+    }
+  }
+
+private:
+  struct Link {
+    uint32_t object;
+    uint32_t constraint;
+  };
+
+  // Objects of chain i are chain_objects[chain_offsets[i], chain_offsets[i +
+  // 1]), and its segment lengths follow the same layout shifted by i.
+  std::vector<uint32_t> chain_offsets{0u};
+  std::vector<uint32_t> chain_objects;
+  std::vector<float> chain_lengths;
+  uint32_t chained_constraint_count = 0;
+};
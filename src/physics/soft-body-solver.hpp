@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "verlet.hpp"
+
+constexpr float SOFT_BODY_PRESSURE = 0.05f;
+
+// Pressure for every soft body, with all vertex indices in one flattened
+// buffer. A body only moves its own vertices, so bodies are solved
+// independently: each gathers its positions into contiguous scratch space,
+// sweeps until its own area error is within tolerance, and writes the
+// positions back once.
+//
+// A sweep projects the area constraint along its gradient, which at vertex i
+// is half the perpendicular of x[i + 1] - x[i - 1], so nothing needs
+// normalising. SOFT_BODY_PRESSURE relaxes the projection so bodies stay
+// squashy rather than snapping back to a circle.
+struct SoftBodySolver {
+  void add(const std::vector<VerletObject *> &vertices,
+           const VerletObject *base, float desired_area) {
+    for (const VerletObject *vertex : vertices) {
+      body_vertices.push_back(vertex - base);
+    }
+    body_offsets.push_back(body_vertices.size());
+    desired_areas.push_back(desired_area);
+    iterations.push_back(0);
+  }
+
+  uint32_t getBodyCount() const { return desired_areas.size(); }
+
+  // Solves bodies [start, end), recording how many sweeps each took.
+  void solve(std::vector<VerletObject> &objects, uint32_t start, uint32_t end,
+             int32_t max_iterations, float tolerance) {
+    static thread_local std::vector<sf::Vector2f> positions;
+    static thread_local std::vector<sf::Vector2f> gradients;
+    static thread_local std::vector<float> weights;
+    for (uint32_t body = start; body < end; body++) {
+      const uint32_t *indices = &body_vertices[body_offsets[body]];
+      const uint32_t points = body_offsets[body + 1] - body_offsets[body];
+      positions.resize(points);
+      gradients.resize(points);
+      weights.resize(points);
+      for (uint32_t i = 0; i < points; i++) {
+        const VerletObject &vertex = objects[indices[i]];
+        positions[i] = vertex.curr_position;
+        weights[i] = vertex.fixed ? 0.0f : 1.0f;
+      }
+
+      const float desired_area = desired_areas[body];
+      int32_t count = 0;
+      while (count < max_iterations && points >= 3) {
+        float area = 0.0f;
+        for (uint32_t i = 0; i < points; i++) {
+          const sf::Vector2f &vertex1 = positions[i];
+          const sf::Vector2f &vertex2 = positions[i + 1 < points ? i + 1 : 0];
+          area += vertex1.x * vertex2.y - vertex2.x * vertex1.y;
+        }
+        const float orientation = area < 0.0f ? -0.5f : 0.5f;
+        const float area_error = orientation * area - desired_area;
+        if (std::abs(area_error) <= tolerance * desired_area)
+          break;
+
+        float square_gradient = 0.0f;
+        for (uint32_t i = 0; i < points; i++) {
+          const sf::Vector2f &prev = positions[i ? i - 1 : points - 1];
+          const sf::Vector2f &next = positions[i + 1 < points ? i + 1 : 0];
+          gradients[i] = orientation * sf::Vector2f(next.y - prev.y,
+                                                    prev.x - next.x);
+          square_gradient += weights[i] * (gradients[i].x * gradients[i].x +
+                                           gradients[i].y * gradients[i].y);
+        }
+        count++;
+        if (!square_gradient)
+          break;
+        const float delta_lambda =
+            -SOFT_BODY_PRESSURE * area_error / square_gradient;
+        for (uint32_t i = 0; i < points; i++) {
+          positions[i] += weights[i] * delta_lambda * gradients[i];
+        }
+      }
+      iterations[body] = count;
+
+      for (uint32_t i = 0; i < points; i++) {
+        objects[indices[i]].curr_position = positions[i];
+      }
+    }
+  }
+
+  int32_t getMaxIterations() const {
+    int32_t max_iterations = 0;
+    for (const int32_t count : iterations) {
+      max_iterations = std::max(max_iterations, count);
+    }
+    return max_iterations;
+  }
+
+private:
+  // Vertices of body i are body_vertices[body_offsets[i], body_offsets[i +
+  // 1]), in winding order.
+  std::vector<uint32_t> body_offsets{0u};
+  std::vector<uint32_t> body_vertices;
+  std::vector<float> desired_areas;
+  std::vector<int32_t> iterations;
+};
@@ -1,21 +1,37 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
 #include <SFML/Graphics.hpp>
 
+#include "../thread_pool/task-graph.hpp"
 #include "../thread_pool/thread_pool.hpp"
+#include "barnes-hut.hpp"
+#include "force-field.hpp"
+#include "islands.hpp"
+#include "level-of-detail.hpp"
+#include "profiler.hpp"
+#include "rope-solver.hpp"
+#include "soft-body-solver.hpp"
+#include "static-colliders.hpp"
 #include "uniform-collision-grid.hpp"
 #include "verlet.hpp"
 
 constexpr int DEFAULT_SUBSTEPS = 8;
 constexpr int JAKOBSEN_ITERATIONS = 10;
+constexpr float CONSTRAINT_TOLERANCE = 0.01f;
+constexpr float SOFT_BODY_TOLERANCE = 0.001f;
 constexpr float MARGIN_WIDTH = 2.0f;
 constexpr float GRAVITY_CONST = 1000.0f;
 constexpr float RESPONSE_COEF = 0.5f;
 constexpr float ATTRACTOR_STRENGTH = 2000.0f;
 constexpr float REPELLER_STRENGTH = 2000.0f;
+constexpr int32_t DETERMINISTIC_STRIPE_WIDTH = 4;
+constexpr uint32_t MIN_STRIPE_WIDTH = 2;
+constexpr float JACOBI_RELAXATION = 1.5f;
+constexpr uint32_t ISLAND_GROUPS_PER_THREAD = 4;
 
 struct Solver {
   Solver(sf::Vector2f size, int32_t substeps, float cell_size,
@@ -27,9 +43,17 @@ struct Solver {
         substeps{DEFAULT_SUBSTEPS}, cell_size{cell_size},
         frame_dt{1.0f / static_cast<float>(framerate)},
         speed_colouring{speed_colouring}, center{0.5f * simulation_size},
-        thread_pool{thread_pool},
+        thread_pool{thread_pool}, profiler{thread_pool.thread_count},
+        force_fields{size}, static_colliders{size, cell_size},
+        detail{size, cell_size},
         gravity{sf::Vector2f(0.0f, gravity_on ? -GRAVITY_CONST : 0.0f)} {
     grid.clear();
+    attractor_field = force_fields.add(
+        {ForceFieldType::Point, center, 0.0f, ATTRACTOR_STRENGTH});
+    repeller_field = force_fields.add(
+        {ForceFieldType::Point, center, 0.0f, -REPELLER_STRENGTH});
+    force_fields.setEnabled(attractor_field, false);
+    force_fields.setEnabled(repeller_field, false);
     objects.reserve(max_object_count);
     constraints.reserve(max_object_count);
   }
@@ -49,60 +73,233 @@ public:
   }
 
   VerletConstraint &addConstraint(VerletObject &object1, VerletObject &object2,
-                                  float target_distance) {
-    return constraints.emplace_back(object1, object2, target_distance);
+                                  float target_distance,
+                                  float compliance = 0.0f) {
+    return constraints.emplace_back(object1, object2, target_distance,
+                                    compliance);
   }
 
   VerletSoftBody &addSoftBody(std::vector<VerletObject *> vertices,
                               std::vector<VerletConstraint *> segments,
                               float radius) {
-    return soft_bodies.emplace_back(vertices, segments, radius);
+    VerletSoftBody &soft_body =
+        soft_bodies.emplace_back(vertices, segments, radius);
+    pressure.add(vertices, objects.data(), soft_body.desired_area);
+    return soft_body;
   }
 
-  VerletRigidBody &addRigidBody(std::vector<VerletObject *> vertices,
-                                std::vector<VerletConstraint *> segments,
-                                float side_length) {
-    return rigid_bodies.emplace_back(vertices, segments, side_length);
+  // The vertices must be in their rest shape when the body is added.
+  VerletRigidBody &addRigidBody(std::vector<VerletObject *> vertices) {
+    return rigid_bodies.emplace_back(vertices);
   }
 
   void updateNaive() {
     time += frame_dt;
+    frame_count++;
+    profiler.beginFrame();
     const float step_dt = getStepDt();
     for (int32_t i = 0; i < substeps; i++) {
-      solveCollisionsNaive();
+      beginSubstep(i);
+      if (i == 0)
+        updateLongRangeForces();
+      {
+        auto scope = profiler.serial(SolverPhase::Collisions);
+        solveCollisionsNaive();
+      }
       updateConstraints();
       updateSoftBodies();
-      updateObjects(step_dt);
+      updateRigidBodies();
+      {
+        auto scope = profiler.serial(SolverPhase::Integration);
+        updateObjects(step_dt);
+      }
     }
   }
 
   void updateCellular() {
     time += frame_dt;
+    frame_count++;
+    profiler.beginFrame();
     const float step_dt = getStepDt();
     for (int32_t i = 0; i < substeps; i++) {
+      beginSubstep(i);
+      if (i == 0)
+        updateLongRangeForces();
       addObjectsToGrid();
-      solveCollisionsCellular();
+      {
+        auto scope = profiler.serial(SolverPhase::Collisions);
+        solveCollisionsCellular();
+      }
       updateConstraints();
       updateSoftBodies();
-      updateObjects(step_dt);
+      updateRigidBodies();
+      {
+        auto scope = profiler.serial(SolverPhase::Integration);
+        updateObjects(step_dt);
+      }
     }
   }
 
+  // After the grid is built, each substep runs as one task graph (see
+  // buildSubstepGraph) instead of phases separated by barriers. The result
+  // is the same as running the phases in order.
   void updateThreaded() {
     time += frame_dt;
+    frame_count++;
+    profiler.beginFrame();
     const float step_dt = getStepDt();
     for (int32_t i = 0; i < substeps; i++) {
+      beginSubstep(i);
+      if (i == 0)
+        updateLongRangeForcesThreaded();
       addObjectsToGrid();
-      solveCollisionsThreaded();
+      updateStripes();
+      updateIslands();
+      buildSubstepGraph(step_dt);
+      substep_graph.run(thread_pool);
+      last_constraint_iterations = 0;
+      for (const int32_t iterations : group_iterations) {
+        last_constraint_iterations =
+            std::max(last_constraint_iterations, iterations);
+      }
+      last_soft_body_iterations = pressure.getMaxIterations();
+      profiler.countConstraintIterations(last_constraint_iterations);
+      profiler.countConstraintIterations(last_soft_body_iterations);
+    }
+  }
+
+  // updateThreaded, but resolving collisions with solveCollisionsJacobi.
+  void updateJacobi() {
+    time += frame_dt;
+    frame_count++;
+    profiler.beginFrame();
+    const float step_dt = getStepDt();
+    for (int32_t i = 0; i < substeps; i++) {
+      beginSubstep(i);
+      if (i == 0)
+        updateLongRangeForcesThreaded();
+      addObjectsToGrid();
+      {
+        auto scope = profiler.phase(SolverPhase::Collisions);
+        solveCollisionsJacobi();
+      }
       updateConstraints();
-      updateSoftBodies();
-      updateObjectsThreaded(step_dt);
+      updateSoftBodiesThreaded();
+      updateRigidBodies();
+      {
+        auto scope = profiler.phase(SolverPhase::Integration);
+        updateObjectsThreaded(step_dt);
+      }
+    }
+  }
+
+  // Reallocates the grid cells and has each worker write its own block of
+  // columns first, so under the usual first-touch policy each block lives on
+  // the memory node of the worker that solves it. Blocks are equal in width,
+  // matching the stripes of a uniform scene; call after pinning the pool.
+  void placeGridOnWorkers() {
+    grid.cells = CellStorage(grid.width * grid.height);
+    const uint32_t thread_count = thread_pool.thread_count;
+    for (uint32_t idx = 0; idx < thread_count; idx++) {
+      thread_pool.enqueueTaskFor(idx, [this, idx, thread_count] {
+        grid.clearColumns(idx * grid.width / thread_count,
+                          (idx + 1) * grid.width / thread_count);
+      });
     }
+    thread_pool.completeAllTasks();
+  }
+
+  SolverStats getStats() const { return profiler.getStats(); }
+
+  void resetStats() { profiler.reset(); }
+
+  void writeChromeTrace(std::ostream &out) const {
+    profiler.writeChromeTrace(out);
   }
 
-  void setAttractor(bool active) { attractor_active = active; }
+  void setAttractor(bool active) {
+    force_fields.setEnabled(attractor_field, active);
+  }
+
+  void setRepeller(bool active) {
+    force_fields.setEnabled(repeller_field, active);
+  }
 
-  void setRepeller(bool active) { repeller_active = active; }
+  // Fields act on every free particle each substep, alongside gravity.
+  uint32_t addForceField(const ForceField &field) {
+    return force_fields.add(field);
+  }
+
+  void setForceField(uint32_t id, const ForceField &field) {
+    force_fields.set(id, field);
+  }
+
+  void setForceFieldEnabled(uint32_t id, bool enabled) {
+    force_fields.setEnabled(id, enabled);
+  }
+
+  void removeForceField(uint32_t id) { force_fields.remove(id); }
+
+  bool hasForceField(uint32_t id) const { return force_fields.isInUse(id); }
+
+  // The fields behind setAttractor and setRepeller, which must not be
+  // removed while the controls can still toggle them.
+  bool isBuiltinForceField(uint32_t id) const {
+    return id == attractor_field || id == repeller_field;
+  }
+
+  // Immovable level geometry, tested only by particles in the cells around
+  // it. A segment is a capsule of radius zero; polygons must be convex, and
+  // addStaticPolygon returns STATIC_SHAPE_INVALID otherwise.
+  uint32_t addStaticSegment(sf::Vector2f a, sf::Vector2f b) {
+    return static_colliders.addCapsule(a, b, 0.0f);
+  }
+
+  uint32_t addStaticCapsule(sf::Vector2f a, sf::Vector2f b, float radius) {
+    return static_colliders.addCapsule(a, b, radius);
+  }
+
+  uint32_t addStaticPolygon(const std::vector<sf::Vector2f> &points) {
+    return static_colliders.addPolygon(points);
+  }
+
+  void removeStaticCollider(uint32_t id) { static_colliders.remove(id); }
+
+  const StaticColliderSet &getStaticColliders() const {
+    return static_colliders;
+  }
+
+  // Particles outside every detail region, in blocks where nothing moves
+  // faster than rest_speed (pixels per second), step once every interval
+  // substeps instead of every one; an interval of one turns this off. The
+  // interval is rounded down to divide the substep count, so every particle
+  // is stepped to the end of each frame. Particles in constraints or bodies
+  // always step every substep.
+  void setCoarseInterval(int32_t interval,
+                         float rest_speed = DEFAULT_REST_SPEED) {
+    interval = std::min(std::max(interval, 1), substeps);
+    while (substeps % interval) {
+      interval--;
+    }
+    detail.setCoarseInterval(interval, rest_speed);
+  }
+
+  int32_t getCoarseInterval() const { return detail.getCoarseInterval(); }
+
+  // Boxes, in pixels, that always step at the full rate, such as the area
+  // around a camera; move them with setDetailRegion as the camera moves.
+  uint32_t addDetailRegion(sf::Vector2f min, sf::Vector2f max) {
+    return detail.addRegion({min, max});
+  }
+
+  void setDetailRegion(uint32_t id, sf::Vector2f min, sf::Vector2f max) {
+    detail.setRegion(id, {min, max});
+  }
+
+  void removeDetailRegion(uint32_t id) { detail.removeRegion(id); }
+
+  // Particles stepping at the coarse interval in the current frame.
+  uint32_t getCoarseCount() const { return detail.getCoarseCount(); }
 
   void setSpeedUp(bool active) { speedup_active = active; }
 
@@ -110,53 +307,320 @@ public:
 
   void setSlomo(bool active) { slomo_active = active; }
 
+  void setDeterministic(bool active) { deterministic = active; }
+
+  bool isDeterministic() const { return deterministic; }
+
+  // Enables mutual forces between all particles, evaluated once per frame
+  // with a Barnes-Hut tree; a strength of zero disables them. Smaller
+  // opening angles are more accurate and more expensive.
+  void setLongRangeForce(float strength,
+                         float opening_angle = DEFAULT_OPENING_ANGLE) {
+    long_range_strength = strength;
+    long_range_opening_angle = opening_angle;
+    long_range.accelerations.clear();
+  }
+
+  // Constraint iterations stop once the largest error of a sweep is below
+  // tolerance (in pixels), or after max_iterations sweeps. Soft bodies share
+  // the maximum but stop at their own SOFT_BODY_TOLERANCE, relative to each
+  // body's rest area.
+  void setConstraintIterations(int32_t max_iterations,
+                               float tolerance = CONSTRAINT_TOLERANCE) {
+    max_constraint_iterations = max_iterations;
+    constraint_tolerance = tolerance;
+  }
+
+  // Sweeps taken by the most recent substep.
+  int32_t getConstraintIterations() const { return last_constraint_iterations; }
+
+  int32_t getSoftBodyIterations() const { return last_soft_body_iterations; }
+
+  // Mean particles per collision stripe over the most in any one stripe, as
+  // of the last threaded substep: 1 is a perfect split.
+  float getStripeBalance() const { return stripe_balance; }
+
   void setObjectVelocity(VerletObject &object, sf::Vector2f velocity) {
     object.setVelocity(velocity, getStepDt());
   }
 
   float getStepDt() { return frame_dt / static_cast<float>(substeps); }
 
+  float getFrameDt() const { return frame_dt; }
+
+  // Frames stepped so far, by any of the update functions.
+  uint64_t getFrameCount() const { return frame_count; }
+
+  int32_t getSubsteps() const { return substeps; }
+
+  float getCellSize() const { return cell_size; }
+
+  // Columns and rows of the collision grid, each cell_size wide from the
+  // origin.
+  int32_t getGridWidth() const { return grid.width; }
+
+  int32_t getGridHeight() const { return grid.height; }
+
+  // The individual substep phases, in the order the update functions run
+  // them, for benchmarks and drivers that schedule phases themselves.
+  void addObjectsToGrid() {
+    auto scope = profiler.serial(SolverPhase::Grid);
+    grid.clear();
+    column_counts.assign(grid.width, 0);
+    in_grid.assign(objects.size(), 0);
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      VerletObject &object = objects[idx];
+      if (!object.radius)
+        continue;
+      if (object.curr_position.x > 1.0f &&
+          object.curr_position.x < simulation_size.x - 1.0f &&
+          object.curr_position.y > 1.0f &&
+          object.curr_position.y < simulation_size.y - 1.0f) {
+        const int32_t column =
+            static_cast<int32_t>(object.curr_position.x / cell_size);
+        if (grid.addObject(
+                column,
+                static_cast<int32_t>(object.curr_position.y / cell_size),
+                idx)) {
+          column_counts[column]++;
+          in_grid[idx] = 1;
+        } else {
+          profiler.countCellOverflow();
+        }
+      }
+    }
+  }
+
+  void solveCollisionsNaive() {
+    for (int32_t i = 0; i < objects.size(); i++) {
+      for (int j = i + 1; j < objects.size(); j++) {
+        solveCollision(i, j);
+      }
+    }
+  }
+
+  void solveCollisionsCellular() {
+    for (uint32_t idx = 0; idx < grid.cells.size(); idx++) {
+      if (grid.cells[idx].object_count > 0) {
+        processCell(grid.cells[idx], idx);
+      }
+    }
+  }
+
+  // Same-coloured stripes never share a neighbouring column, so each pass can
+  // run in any order; the barrier between passes keeps the result fixed for
+  // a given stripe layout.
+  void solveCollisionsThreaded() {
+    updateStripes();
+    solveCollisionsStriped();
+  }
+
+  // Lays out the collision stripes for the grid as last built.
+  void updateStripes() {
+    column_prefix.resize(grid.width + 1);
+    column_prefix[0] = 0;
+    for (int32_t column = 0; column < grid.width; column++) {
+      column_prefix[column + 1] = column_prefix[column] + column_counts[column];
+    }
+    if (deterministic) {
+      stripe_bounds.clear();
+      for (int32_t column = 0; column < grid.width;
+           column += DETERMINISTIC_STRIPE_WIDTH) {
+        stripe_bounds.push_back(column);
+      }
+      stripe_bounds.push_back(grid.width);
+    } else {
+      balanceStripes(std::min<uint32_t>(2 * thread_pool.thread_count,
+                                        grid.width / MIN_STRIPE_WIDTH));
+    }
+    measureStripeBalance();
+  }
+
+  // Every particle gathers the corrections from all of its own contacts
+  // while only reading positions, so the grid can be split anywhere and
+  // nothing is written twice. A second pass then moves each particle by the
+  // average of its corrections, over-relaxed by JACOBI_RELAXATION. This
+  // converges more slowly than the striped Gauss-Seidel resolver but needs no
+  // colouring and no barrier between stripes. Each particle sums its contacts
+  // in a fixed order, so the result does not depend on the thread count.
+  void solveCollisionsJacobi() {
+    corrections.resize(objects.size(), {0.0f, 0.0f});
+    contact_counts.resize(objects.size(), 0);
+    thread_pool.dispatch(grid.cells.size(), [&](uint32_t start, uint32_t end) {
+      auto scope = profiler.task(SolverPhase::Collisions);
+      for (uint32_t idx = start; idx < end; idx++) {
+        const CollisionCell &cell = grid.cells[idx];
+        for (uint32_t i = 0; i < cell.object_count; i++) {
+          if (isDetailActive(cell.objects[i])) {
+            gatherCorrections(cell.objects[i], idx);
+          }
+        }
+      }
+    });
+    thread_pool.dispatch(objects.size(), [&](uint32_t start, uint32_t end) {
+      auto scope = profiler.task(SolverPhase::Collisions);
+      for (uint32_t idx = start; idx < end; idx++) {
+        if (!contact_counts[idx])
+          continue;
+        objects[idx].curr_position +=
+            corrections[idx] * (JACOBI_RELAXATION / contact_counts[idx]);
+        corrections[idx] = {0.0f, 0.0f};
+        contact_counts[idx] = 0;
+      }
+    });
+  }
+
+  // Ropes are solved directly; only the constraints that are not part of a
+  // simple chain still need Gauss-Seidel iterations, island by island.
+  void updateConstraints() {
+    if (constraints.empty())
+      return;
+    auto scope = profiler.serial(SolverPhase::Constraints);
+    updateIslands();
+    ropes.solve(objects);
+    const float step_dt = getStepDt();
+    last_constraint_iterations = 0;
+    for (uint32_t island = 0; island < islands.getIslandCount(); island++) {
+      last_constraint_iterations =
+          std::max(last_constraint_iterations,
+                   solveIslandConstraints(island, step_dt));
+    }
+    profiler.countConstraintIterations(last_constraint_iterations);
+  }
+
+  void updateSoftBodies() {
+    if (soft_bodies.empty())
+      return;
+    auto scope = profiler.serial(SolverPhase::SoftBodies);
+    pressure.solve(objects, 0, pressure.getBodyCount(),
+                   max_constraint_iterations, SOFT_BODY_TOLERANCE);
+    last_soft_body_iterations = pressure.getMaxIterations();
+    profiler.countConstraintIterations(last_soft_body_iterations);
+  }
+
+  void updateSoftBodiesThreaded() {
+    if (soft_bodies.empty())
+      return;
+    auto scope = profiler.phase(SolverPhase::SoftBodies);
+    thread_pool.dispatch(
+        pressure.getBodyCount(), [&](uint32_t start, uint32_t end) {
+          auto scope = profiler.task(SolverPhase::SoftBodies);
+          pressure.solve(objects, start, end, max_constraint_iterations,
+                         SOFT_BODY_TOLERANCE);
+        });
+    last_soft_body_iterations = pressure.getMaxIterations();
+    profiler.countConstraintIterations(last_soft_body_iterations);
+  }
+
+  void updateRigidBodies() {
+    if (rigid_bodies.empty())
+      return;
+    auto scope = profiler.serial(SolverPhase::RigidBodies);
+    for (auto &rigid_body : rigid_bodies) {
+      rigid_body.apply();
+    }
+  }
+
+  void updateLongRangeForces() {
+    if (!long_range_strength)
+      return;
+    auto scope = profiler.serial(SolverPhase::LongRange);
+    long_range.build(objects);
+    long_range.evaluate(objects, long_range_strength,
+                        long_range_opening_angle);
+  }
+
+  void updateLongRangeForcesThreaded() {
+    if (!long_range_strength)
+      return;
+    auto scope = profiler.phase(SolverPhase::LongRange);
+    long_range.buildThreaded(objects, thread_pool);
+    long_range.evaluateThreaded(objects, long_range_strength,
+                                long_range_opening_angle, thread_pool);
+  }
+
+  void updateObjects(float dt) {
+    for (auto &object : objects) {
+      updateObject(object, dt);
+    }
+  }
+
+  void updateObjectsThreaded(float dt) {
+    thread_pool.dispatch(objects.size(), [&](uint32_t start, uint32_t end) {
+      auto scope = profiler.task(SolverPhase::Integration);
+      for (uint32_t idx = start; idx < end; idx++) {
+        updateObject(objects[idx], dt);
+      }
+    });
+  }
+
 private:
   sf::Vector2f gravity = {0.0f, -GRAVITY_CONST};
   sf::Vector2f simulation_size;
   UniformCollisionGrid grid;
   sf::Vector2f center;
   float cell_size;
-  bool attractor_active = false;
-  bool repeller_active = false;
   bool speedup_active = false;
   bool slowdown_active = false;
   bool slomo_active = false;
   bool speed_colouring = false;
+  bool deterministic = false;
+  float long_range_strength = 0.0f;
+  float long_range_opening_angle = DEFAULT_OPENING_ANGLE;
+  BarnesHutTree long_range;
+  RopeSolver ropes;
+  SoftBodySolver pressure;
+  uint32_t rope_constraint_count = 0;
+  uint32_t island_soft_body_count = 0;
+  uint32_t island_rigid_body_count = 0;
+  IslandSet islands;
+  tp::TaskGraph substep_graph;
+  std::vector<uint8_t> in_grid;
+  std::vector<uint32_t> island_columns;
+  std::vector<uint32_t> island_order;
+  std::vector<uint32_t> group_offsets;
+  std::vector<int32_t> group_iterations;
+  int32_t max_constraint_iterations = JAKOBSEN_ITERATIONS;
+  float constraint_tolerance = CONSTRAINT_TOLERANCE;
+  int32_t last_constraint_iterations = 0;
+  int32_t last_soft_body_iterations = 0;
+  std::vector<uint32_t> column_counts;
+  std::vector<uint32_t> column_prefix;
+  std::vector<uint32_t> stripe_bounds;
+  float stripe_balance = 1.0f;
+  std::vector<sf::Vector2f> corrections;
+  std::vector<uint32_t> contact_counts;
   int32_t substeps;
   float frame_dt = 0.0f;
+  uint64_t frame_count = 0;
   tp::ThreadPool &thread_pool;
+  SolverProfiler profiler;
+  ForceFieldSet force_fields;
+  StaticColliderSet static_colliders;
+  DetailMap detail;
+  int32_t detail_substep = 0;
+  uint32_t attractor_field;
+  uint32_t repeller_field;
 
-  void applyGravity() {
-    for (auto &obj : objects) {
-      obj.acceleration -= gravity;
+  // The first substep of a frame decides which particles step coarsely.
+  void beginSubstep(int32_t i) {
+    profiler.beginSubstep(i);
+    detail_substep = i;
+    if (i == 0 && (detail.isEnabled() || detail.getCoarseCount())) {
+      updateIslands();
+      detail.assign(objects, getStepDt(), [this](uint32_t idx) {
+        return islands.isCoupled(idx);
+      });
     }
   }
 
-  void applyAttractor(VerletObject &object) {
-    const sf::Vector2f displacement = center - object.curr_position;
-    const float square_distance =
-        displacement.x * displacement.x + displacement.y * displacement.y;
-    if (square_distance > 0) {
-      const float distance = sqrt(square_distance);
-      sf::Vector2f force = (displacement / distance) * ATTRACTOR_STRENGTH;
-      object.accelerate(force);
-    }
+  bool isDetailActive(uint32_t object_id) const {
+    return detail.isActive(object_id, detail_substep);
   }
 
-  void applyRepeller(VerletObject &object) {
-    const sf::Vector2f displacement = center - object.curr_position;
-    const float square_distance =
-        displacement.x * displacement.x + displacement.y * displacement.y;
-    if (square_distance > 0) {
-      const float distance = sqrt(square_distance);
-      sf::Vector2f force = (displacement / distance) * ATTRACTOR_STRENGTH;
-      object.accelerate(-force);
+  void applyGravity() {
+    for (auto &obj : objects) {
+      obj.acceleration -= gravity;
     }
   }
 
@@ -196,23 +660,6 @@ private:
     object.curr_position -= 0.2f * collision_normal * RESPONSE_COEF;
   }
 
-  void addObjectsToGrid() {
-    grid.clear();
-    for (uint32_t idx = 0; idx < objects.size(); idx++) {
-      VerletObject &object = objects[idx];
-      if (!object.radius)
-        continue;
-      if (object.curr_position.x > 1.0f &&
-          object.curr_position.x < simulation_size.x - 1.0f &&
-          object.curr_position.y > 1.0f &&
-          object.curr_position.y < simulation_size.y - 1.0f) {
-        grid.addObject(static_cast<int32_t>(object.curr_position.x / cell_size),
-                       static_cast<int32_t>(object.curr_position.y / cell_size),
-                       idx);
-      }
-    }
-  }
-
   void solveCollision(int32_t object_id1, int32_t object_id2) {
     if (body.count(object_id1) && body.count(object_id2)) {
       if (body[object_id1] == body[object_id2])
@@ -220,14 +667,19 @@ private:
     }
     VerletObject &object1 = objects[object_id1];
     VerletObject &object2 = objects[object_id2];
-    if (object1.fixed && object2.fixed)
+    // A particle waiting for its next coarse step holds still, as if fixed.
+    const bool held1 = object1.fixed || !isDetailActive(object_id1);
+    const bool held2 = object2.fixed || !isDetailActive(object_id2);
+    if (held1 && held2)
       return;
+    profiler.countCandidates(1);
     const sf::Vector2f displacement =
         object1.curr_position - object2.curr_position;
     const float square_distance =
         displacement.x * displacement.x + displacement.y * displacement.y;
     const float min_distance = object1.radius + object2.radius;
     if (square_distance < min_distance * min_distance) {
+      profiler.countContact();
       const float radius1 = body.count(object_id1) ? 20.0f : object1.radius;
       const float radius2 = body.count(object_id2) ? 20.0f : object2.radius;
       const float mass_proportion1 = radius1 * radius1 * radius1;
@@ -238,12 +690,12 @@ private:
       const float collision_ratio1 = mass_proportion2 / total_mass_proportion;
       const float collision_ratio2 = mass_proportion1 / total_mass_proportion;
       const float delta = RESPONSE_COEF * (distance - min_distance);
-      if (!object1.fixed && !object2.fixed) {
+      if (!held1 && !held2) {
         object1.curr_position -=
             0.5f * collision_normal * (collision_ratio1 * delta);
         object2.curr_position +=
             0.5f * collision_normal * (collision_ratio2 * delta);
-      } else if (object1.fixed && !object2.fixed) {
+      } else if (held1) {
         object2.curr_position += collision_normal * (collision_ratio1 * delta);
       } else {
         object1.curr_position -= collision_normal * (collision_ratio2 * delta);
@@ -251,10 +703,63 @@ private:
     }
   }
 
-  void solveCollisionsNaive() {
-    for (int32_t i = 0; i < objects.size(); i++) {
-      for (int j = i + 1; j < objects.size(); j++) {
-        solveCollision(i, j);
+  // The part of solveCollision that moves object_id1, added to its
+  // accumulated correction instead of applied.
+  void addCollisionCorrection(uint32_t object_id1, uint32_t object_id2) {
+    if (body.count(object_id1) && body.count(object_id2)) {
+      if (body.at(object_id1) == body.at(object_id2))
+        return;
+    }
+    const VerletObject &object1 = objects[object_id1];
+    const VerletObject &object2 = objects[object_id2];
+    if (object1.fixed || !isDetailActive(object_id1))
+      return;
+    if (object_id1 < object_id2)
+      profiler.countCandidates(1);
+    const sf::Vector2f displacement =
+        object1.curr_position - object2.curr_position;
+    const float square_distance =
+        displacement.x * displacement.x + displacement.y * displacement.y;
+    const float min_distance = object1.radius + object2.radius;
+    if (square_distance >= min_distance * min_distance || !square_distance)
+      return;
+    if (object_id1 < object_id2)
+      profiler.countContact();
+    const float radius1 = body.count(object_id1) ? 20.0f : object1.radius;
+    const float radius2 = body.count(object_id2) ? 20.0f : object2.radius;
+    const float mass_proportion1 = radius1 * radius1 * radius1;
+    const float mass_proportion2 = radius2 * radius2 * radius2;
+    const float total_mass_proportion = mass_proportion1 + mass_proportion2;
+    const float distance = sqrt(square_distance);
+    const sf::Vector2f collision_normal = displacement / distance;
+    const float delta = RESPONSE_COEF * (distance - min_distance);
+    if (object2.fixed || !isDetailActive(object_id2)) {
+      corrections[object_id1] -= collision_normal *
+                                 (mass_proportion1 / total_mass_proportion *
+                                  delta);
+    } else {
+      corrections[object_id1] -= 0.5f * collision_normal *
+                                 (mass_proportion2 / total_mass_proportion *
+                                  delta);
+    }
+    contact_counts[object_id1]++;
+  }
+
+  void gatherCorrections(uint32_t object_id, int32_t index) {
+    const int32_t x = index / grid.height;
+    const int32_t y = index % grid.height;
+    for (int32_t dx = -1; dx <= 1; dx++) {
+      if (x + dx < 0 || x + dx >= grid.width)
+        continue;
+      for (int32_t dy = -1; dy <= 1; dy++) {
+        if (y + dy < 0 || y + dy >= grid.height)
+          continue;
+        const CollisionCell &cell = grid.cells[index + dx * grid.height + dy];
+        for (uint32_t i = 0; i < cell.object_count; i++) {
+          if (cell.objects[i] != object_id) {
+            addCollisionCorrection(object_id, cell.objects[i]);
+          }
+        }
       }
     }
   }
@@ -271,7 +776,11 @@ private:
   void processCell(const CollisionCell &cell, int32_t index) {
     const int32_t x = index / grid.height;
     const int32_t y = index % grid.height;
-    for (const auto &object_id : cell.objects) {
+    for (uint32_t i = 0; i < cell.object_count; i++) {
+      const uint32_t object_id = cell.objects[i];
+      // Its contacts with stepping neighbours are solved from their side.
+      if (!isDetailActive(object_id))
+        continue;
       if (x > 0) {
         solveObjectCellCollisions(object_id, grid.cells[index - grid.height]);
         if (y > 0)
@@ -298,26 +807,22 @@ private:
     }
   }
 
-  void solveCollisionsCellular() {
-    for (uint32_t idx = 0; idx < grid.cells.size(); idx++) {
-      if (grid.cells[idx].object_count > 0) {
-        processCell(grid.cells[idx], idx);
-      }
-    }
-  }
-
   void updateObject(VerletObject &object, float dt) {
+    const uint32_t interval = detail.getInterval(&object - objects.data());
+    if (interval > 1) {
+      if ((detail_substep + 1) % interval)
+        return;
+      dt *= interval;
+    }
     if (!object.radius && !object.fixed) {
       object.acceleration -= gravity;
     }
     if (!object.fixed) {
       object.acceleration -= gravity;
-      if (attractor_active) {
-        applyAttractor(object);
-      }
-      if (repeller_active) {
-        applyRepeller(object);
+      if (long_range_strength) {
+        object.accelerate(long_range.getAcceleration(&object - objects.data()));
       }
+      object.accelerate(force_fields.getAcceleration(object, dt));
       if (speedup_active) {
         applySpeedUp(object);
       }
@@ -333,86 +838,297 @@ private:
       object.updateColour(dt);
     }
     applyBorders(object);
+    if (!object.fixed) {
+      static_colliders.collide(object);
+    }
+    // Between frames last_position is always one substep behind.
+    if (interval > 1 && detail_substep + 1 == substeps) {
+      object.last_position =
+          object.curr_position - (object.curr_position - object.last_position) /
+                                     static_cast<float>(interval);
+    }
   }
 
-  void updateObjects(float dt) {
-    for (auto &object : objects) {
-      updateObject(object, dt);
+  void updateObjectsCellular(float dt) {
+    for (auto &cell : grid.cells) {
+      if (cell.object_count > 0) {
+        for (uint32_t i = 0; i < cell.object_count; i++) {
+          updateObject(objects[cell.objects[i]], dt);
+        }
+      }
     }
   }
 
-  void updateConstraints() {
-    if (constraints.empty())
-      return;
-    for (int32_t i = 0; i < JAKOBSEN_ITERATIONS; i++) {
-      for (auto &constraint : constraints) {
-        constraint.apply();
+  void solvePartitionThreaded(uint32_t start, uint32_t end) {
+    for (uint32_t idx = start; idx < end; idx++) {
+      if (grid.cells[idx].object_count > 0) {
+        processCell(grid.cells[idx], idx);
       }
     }
   }
 
-  void updateSoftBodies() {
-    if (soft_bodies.empty())
-      return;
-    for (int32_t i = 0; i < JAKOBSEN_ITERATIONS; i++) {
-      for (auto &soft_body : soft_bodies) {
-        soft_body.apply();
-      }
+  // Splits the columns into partition_count stripes holding about the same
+  // number of particles, using the column counts from addObjectsToGrid.
+  // Every stripe is at least MIN_STRIPE_WIDTH columns wide, so two stripes of
+  // the same colour never touch a common column.
+  void balanceStripes(uint32_t partition_count) {
+    partition_count = std::max(partition_count, 1u);
+    const uint32_t total = column_prefix[grid.width];
+    stripe_bounds.assign(1, 0u);
+    for (uint32_t idx = 1; idx < partition_count; idx++) {
+      const uint32_t target =
+          static_cast<uint64_t>(total) * idx / partition_count;
+      const uint32_t min_column = stripe_bounds.back() + MIN_STRIPE_WIDTH;
+      const uint32_t max_column =
+          grid.width - MIN_STRIPE_WIDTH * (partition_count - idx);
+      const auto first = column_prefix.begin() + min_column;
+      const auto last =
+          column_prefix.begin() + std::max(min_column, max_column);
+      stripe_bounds.push_back(std::lower_bound(first, last, target) -
+                              column_prefix.begin());
     }
+    stripe_bounds.push_back(grid.width);
   }
 
-  void updateObjectsCellular(float dt) {
-    for (auto &cell : grid.cells) {
-      if (cell.object_count > 0) {
-        for (auto &object_id : cell.objects) {
-          updateObject(objects[object_id], dt);
-        }
+  void measureStripeBalance() {
+    const uint32_t partition_count = stripe_bounds.size() - 1;
+    const uint32_t total = column_prefix[grid.width];
+    uint32_t largest = 0;
+    for (uint32_t idx = 0; idx < partition_count; idx++) {
+      largest = std::max(largest, column_prefix[stripe_bounds[idx + 1]] -
+                                      column_prefix[stripe_bounds[idx]]);
+    }
+    stripe_balance =
+        largest ? static_cast<float>(total) / (partition_count * largest)
+                : 1.0f;
+  }
+
+  // Stripes are handed out to workers in contiguous blocks, so a worker
+  // keeps solving the same region of the grid from substep to substep.
+  uint32_t getStripeWorker(uint32_t stripe) const {
+    return stripe * thread_pool.thread_count / (stripe_bounds.size() - 1);
+  }
+
+  // Even stripes run in the first pass and odd ones in the second.
+  void solveCollisionsStriped() {
+    const uint32_t partition_count = stripe_bounds.size() - 1;
+    for (uint32_t pass = 0; pass < 2; pass++) {
+      for (uint32_t idx = pass; idx < partition_count; idx += 2) {
+        thread_pool.enqueueTaskFor(getStripeWorker(idx), [this, idx] {
+          auto scope = profiler.task(SolverPhase::Collisions, idx);
+          solvePartitionThreaded(stripe_bounds[idx] * grid.height,
+                                 stripe_bounds[idx + 1] * grid.height);
+        });
       }
+      thread_pool.completeAllTasks();
     }
   }
 
-  void updateObjectsThreaded(float dt) {
-    thread_pool.dispatch(objects.size(), [&](uint32_t start, uint32_t end) {
-      for (uint32_t idx = start; idx < end; idx++) {
-        updateObject(objects[idx], dt);
+  // Re-finds ropes and islands whenever constraints or bodies are added.
+  void updateIslands() {
+    if (constraints.size() == rope_constraint_count &&
+        soft_bodies.size() == island_soft_body_count &&
+        rigid_bodies.size() == island_rigid_body_count)
+      return;
+    ropes.detect(objects, constraints);
+    islands.build(objects, constraints, soft_bodies, rigid_bodies, ropes);
+    rope_constraint_count = constraints.size();
+    island_soft_body_count = soft_bodies.size();
+    island_rigid_body_count = rigid_bodies.size();
+  }
+
+  // Sweeps an island's non-chain constraints until the largest residual of
+  // a sweep is within tolerance, and returns the number of sweeps.
+  int32_t solveIslandConstraints(uint32_t island, float step_dt) {
+    const uint32_t *first = islands.beginWork(island, IslandWork::Constraint);
+    const uint32_t *last = islands.endWork(island, IslandWork::Constraint);
+    if (first == last)
+      return 0;
+    for (const uint32_t *idx = first; idx != last; idx++) {
+      constraints[*idx].lambda = 0.0f;
+    }
+    int32_t iterations = 0;
+    float max_error = INFINITY;
+    while (max_error > constraint_tolerance &&
+           iterations < max_constraint_iterations) {
+      max_error = 0.0f;
+      for (const uint32_t *idx = first; idx != last; idx++) {
+        max_error = std::max(max_error, constraints[*idx].apply(step_dt));
       }
-    });
+      iterations++;
+    }
+    return iterations;
   }
 
-  void solvePartitionThreaded(uint32_t start, uint32_t end) {
-    for (uint32_t idx = start; idx < end; idx++) {
-      if (grid.cells[idx].object_count > 0) {
-        processCell(grid.cells[idx], idx);
+  // Everything updateConstraints, updateSoftBodies and updateRigidBodies do
+  // to one island, in the same order, followed by integrating its particles.
+  int32_t solveIsland(uint32_t island, float step_dt) {
+    for (const uint32_t *chain = islands.beginWork(island, IslandWork::Chain);
+         chain != islands.endWork(island, IslandWork::Chain); chain++) {
+      ropes.solveChain(objects, *chain);
+    }
+    const int32_t iterations = solveIslandConstraints(island, step_dt);
+    for (const uint32_t *body = islands.beginWork(island, IslandWork::SoftBody);
+         body != islands.endWork(island, IslandWork::SoftBody); body++) {
+      pressure.solve(objects, *body, *body + 1, max_constraint_iterations,
+                     SOFT_BODY_TOLERANCE);
+    }
+    for (const uint32_t *body =
+             islands.beginWork(island, IslandWork::RigidBody);
+         body != islands.endWork(island, IslandWork::RigidBody); body++) {
+      rigid_bodies[*body].apply();
+    }
+    for (const uint32_t *idx = islands.beginObjects(island);
+         idx != islands.endObjects(island); idx++) {
+      updateObject(objects[*idx], step_dt);
+    }
+    return iterations;
+  }
+
+  uint32_t getStripe(int32_t column) const {
+    const uint32_t stripe =
+        std::upper_bound(stripe_bounds.begin(), stripe_bounds.end(),
+                         std::max(column, 0)) -
+        stripe_bounds.begin() - 1;
+    return std::min<uint32_t>(stripe, stripe_bounds.size() - 2);
+  }
+
+  // Sorts the islands by their leftmost column and cuts them into groups of
+  // about the same number of particles, so each group spans few stripes.
+  // Records each island's column span in island_columns.
+  void groupIslands() {
+    const uint32_t island_count = islands.getIslandCount();
+    island_columns.resize(2 * island_count);
+    island_order.resize(island_count);
+    for (uint32_t island = 0; island < island_count; island++) {
+      int32_t min_column = grid.width - 1;
+      int32_t max_column = 0;
+      for (const uint32_t *idx = islands.beginObjects(island);
+           idx != islands.endObjects(island); idx++) {
+        const int32_t column = std::min(
+            std::max(static_cast<int32_t>(objects[*idx].curr_position.x /
+                                          cell_size),
+                     0),
+            grid.width - 1);
+        min_column = std::min(min_column, column);
+        max_column = std::max(max_column, column);
+      }
+      island_columns[2 * island] = min_column;
+      island_columns[2 * island + 1] = max_column;
+      island_order[island] = island;
+    }
+    std::sort(island_order.begin(), island_order.end(),
+              [&](uint32_t island_1, uint32_t island_2) {
+                return island_columns[2 * island_1] <
+                       island_columns[2 * island_2];
+              });
+
+    const uint32_t group_count = std::min(
+        island_count, ISLAND_GROUPS_PER_THREAD * thread_pool.thread_count);
+    const uint32_t coupled_count =
+        islands.endObjects(island_count - 1) - islands.beginObjects(0);
+    group_offsets.assign(1, 0u);
+    uint32_t size = 0;
+    for (uint32_t idx = 0; idx < island_count; idx++) {
+      const uint32_t island = island_order[idx];
+      size += islands.endObjects(island) - islands.beginObjects(island);
+      if (static_cast<uint64_t>(size) * group_count >=
+              static_cast<uint64_t>(coupled_count) * group_offsets.size() ||
+          idx + 1 == island_count) {
+        group_offsets.push_back(idx + 1);
       }
     }
   }
 
-  void solveCollisionsThreaded() {
-    const uint32_t thread_count = thread_pool.thread_count;
-    const uint32_t partition_count = thread_count * 2;
-    const uint32_t partition_size =
-        (grid.width / partition_count) * grid.height;
-    const uint32_t last_cell = 2 * thread_count * partition_size;
+  // Collision stripes wait only for their neighbours: each black stripe for
+  // the red stripes either side of it. Free particles in a stripe are
+  // integrated once that stripe and both neighbours have been solved. Each
+  // group of islands waits only for the stripes that could have touched its
+  // particles, then solves and integrates them. Particles outside the grid
+  // collide with nothing, so they are integrated straight away.
+  void buildSubstepGraph(float step_dt) {
+    substep_graph.clear();
+    const uint32_t stripe_count = stripe_bounds.size() - 1;
+    for (uint32_t stripe = 0; stripe < stripe_count; stripe++) {
+      substep_graph.addTask(
+          [this, stripe] {
+            auto scope = profiler.task(SolverPhase::Collisions, stripe);
+            solvePartitionThreaded(stripe_bounds[stripe] * grid.height,
+                                   stripe_bounds[stripe + 1] * grid.height);
+          },
+          getStripeWorker(stripe));
+    }
+    for (uint32_t stripe = 1; stripe < stripe_count; stripe += 2) {
+      substep_graph.addDependency(stripe - 1, stripe);
+      if (stripe + 1 < stripe_count) {
+        substep_graph.addDependency(stripe + 1, stripe);
+      }
+    }
 
-    for (uint32_t idx = 0; idx < thread_count; idx++) {
-      thread_pool.enqueueTask([this, idx, partition_size] {
-        uint32_t const start = 2 * idx * partition_size;
-        uint32_t const end = start + partition_size;
-        solvePartitionThreaded(start, end);
-      });
+    for (uint32_t stripe = 0; stripe < stripe_count; stripe++) {
+      const tp::TaskGraph::TaskId task = substep_graph.addTask(
+          [this, stripe, step_dt] {
+            auto scope = profiler.task(SolverPhase::Integration);
+            for (uint32_t idx = stripe_bounds[stripe] * grid.height;
+                 idx < stripe_bounds[stripe + 1] * grid.height; idx++) {
+              const CollisionCell &cell = grid.cells[idx];
+              for (uint32_t i = 0; i < cell.object_count; i++) {
+                if (!islands.isCoupled(cell.objects[i])) {
+                  updateObject(objects[cell.objects[i]], step_dt);
+                }
+              }
+            }
+          },
+          getStripeWorker(stripe));
+      for (uint32_t neighbour = stripe ? stripe - 1 : 0;
+           neighbour < std::min(stripe + 2, stripe_count); neighbour++) {
+        substep_graph.addDependency(neighbour, task);
+      }
     }
-    for (uint32_t idx = 0; idx < thread_count; idx++) {
-      thread_pool.enqueueTask([this, idx, partition_size] {
-        uint32_t const start = (2 * idx + 1) * partition_size;
-        uint32_t const end = start + partition_size;
-        solvePartitionThreaded(start, end);
-      });
+
+    substep_graph.addTask([this, step_dt] {
+      auto scope = profiler.task(SolverPhase::Integration);
+      for (uint32_t idx = 0; idx < objects.size(); idx++) {
+        if (!in_grid[idx] && !islands.isCoupled(idx)) {
+          updateObject(objects[idx], step_dt);
+        }
+      }
+    });
+
+    if (!islands.getIslandCount()) {
+      group_iterations.clear();
+      return;
     }
-    if (last_cell < grid.cells.size()) {
-      thread_pool.enqueueTask([this, last_cell] {
-        solvePartitionThreaded(last_cell, grid.cells.size());
-      });
+    groupIslands();
+    const uint32_t group_count = group_offsets.size() - 1;
+    group_iterations.assign(group_count, 0);
+    for (uint32_t group = 0; group < group_count; group++) {
+      int32_t min_column = grid.width - 1;
+      int32_t max_column = 0;
+      for (uint32_t idx = group_offsets[group]; idx < group_offsets[group + 1];
+           idx++) {
+        const uint32_t island = island_order[idx];
+        min_column = std::min<int32_t>(min_column, island_columns[2 * island]);
+        max_column =
+            std::max<int32_t>(max_column, island_columns[2 * island + 1]);
+      }
+      const uint32_t first_stripe = getStripe(min_column - 1);
+      const uint32_t last_stripe = getStripe(max_column + 1);
+      const tp::TaskGraph::TaskId task = substep_graph.addTask(
+          [this, group, step_dt] {
+            auto scope = profiler.task(SolverPhase::Constraints);
+            int32_t iterations = 0;
+            for (uint32_t idx = group_offsets[group];
+                 idx < group_offsets[group + 1]; idx++) {
+              iterations =
+                  std::max(iterations, solveIsland(island_order[idx], step_dt));
+            }
+            group_iterations[group] = iterations;
+          },
+          getStripeWorker(first_stripe));
+      for (uint32_t stripe = first_stripe; stripe <= last_stripe; stripe++) {
+        substep_graph.addDependency(stripe, task);
+      }
     }
-    thread_pool.completeAllTasks();
   }
 };
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../thread_pool/thread_pool.hpp"
+#include "solver.hpp"
+
+constexpr uint32_t SPATIAL_QUERY_CHUNK = 64;
+
+struct SpatialHit {
+  uint32_t object;
+  // From the query point to the object's centre, or along a ray to where
+  // it first touches the object.
+  float distance;
+};
+
+struct SpatialQuery {
+  enum Type : uint8_t { Radius, Box, Nearest, Ray };
+  Type type;
+  // Radius and Nearest: the query point. Box: the minimum corner. Ray: the
+  // start of the segment.
+  sf::Vector2f point;
+  // Box: the maximum corner. Ray: the end of the segment.
+  sf::Vector2f end;
+  // Radius: the search radius. Nearest: the furthest a result may be, or 0
+  // for no limit.
+  float radius;
+  // Nearest: how many objects to find. Ray: the most hits to report, or 0
+  // for all of them.
+  uint32_t count;
+};
+
+// A snapshot of where every object is, bucketed into the cells of the
+// solver's collision grid (column-major, like UniformCollisionGrid) but
+// without its per-cell capacity, and with positions and radii copied out
+// in cell order so queries only read this index. The index never changes
+// between builds, so any number of threads can query it at once, even while
+// the solver steps; isCurrent tells whether it still matches the solver.
+struct SpatialIndex {
+  void build(const Solver &solver) {
+    const float cell = solver.getCellSize();
+    cell_size = cell;
+    inverse_cell_size = 1.0f / cell;
+    width = solver.getGridWidth();
+    height = solver.getGridHeight();
+    built_frame = solver.getFrameCount();
+    built_object_count = solver.objects.size();
+    max_radius = 0.0f;
+
+    const std::vector<VerletObject> &objects = solver.objects;
+    object_cells.resize(objects.size());
+    cell_offsets.assign(width * height + 1, 0);
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      const sf::Vector2i coords = getCell(objects[idx].curr_position);
+      object_cells[idx] = coords.x * height + coords.y;
+      cell_offsets[object_cells[idx] + 1]++;
+      max_radius = std::max(max_radius, objects[idx].radius);
+    }
+    for (uint32_t idx = 0; idx + 1 < cell_offsets.size(); idx++) {
+      cell_offsets[idx + 1] += cell_offsets[idx];
+    }
+    ids.resize(objects.size());
+    positions.resize(objects.size());
+    radii.resize(objects.size());
+    cursor.assign(cell_offsets.begin(), cell_offsets.end() - 1);
+    for (uint32_t idx = 0; idx < objects.size(); idx++) {
+      const uint32_t slot = cursor[object_cells[idx]]++;
+      ids[slot] = idx;
+      positions[slot] = objects[idx].curr_position;
+      radii[slot] = objects[idx].radius;
+    }
+    reach = static_cast<int32_t>(std::ceil(max_radius * inverse_cell_size));
+  }
+
+  // False once the solver has stepped or gained objects since the build.
+  bool isCurrent(const Solver &solver) const {
+    return built_frame == solver.getFrameCount() &&
+           built_object_count == solver.objects.size();
+  }
+
+  uint32_t getObjectCount() const { return ids.size(); }
+
+  // Objects overlapping the disc, in no particular order.
+  void queryRadius(sf::Vector2f centre, float radius,
+                   std::vector<SpatialHit> &hits) const {
+    const float margin = radius + max_radius;
+    forEachInBox(centre - sf::Vector2f{margin, margin},
+                 centre + sf::Vector2f{margin, margin}, [&](uint32_t slot) {
+                   const sf::Vector2f offset = positions[slot] - centre;
+                   const float distance = std::sqrt(offset.x * offset.x +
+                                                     offset.y * offset.y);
+                   if (distance <= radius + radii[slot]) {
+                     hits.push_back({ids[slot], distance});
+                   }
+                 });
+  }
+
+  // Objects overlapping the axis-aligned box, in no particular order.
+  void queryBox(sf::Vector2f min, sf::Vector2f max,
+                std::vector<SpatialHit> &hits) const {
+    const sf::Vector2f centre = 0.5f * (min + max);
+    forEachInBox(min - sf::Vector2f{max_radius, max_radius},
+                 max + sf::Vector2f{max_radius, max_radius},
+                 [&](uint32_t slot) {
+                   const sf::Vector2f position = positions[slot];
+                   const sf::Vector2f closest{
+                       std::clamp(position.x, min.x, max.x),
+                       std::clamp(position.y, min.y, max.y)};
+                   const sf::Vector2f offset = position - closest;
+                   if (offset.x * offset.x + offset.y * offset.y <=
+                       radii[slot] * radii[slot]) {
+                     const sf::Vector2f to_centre = position - centre;
+                     hits.push_back({ids[slot],
+                                     std::sqrt(to_centre.x * to_centre.x +
+                                               to_centre.y * to_centre.y)});
+                   }
+                 });
+  }
+
+  // The count objects whose centres are nearest the point, nearest first.
+  // Rings of cells are searched outwards until nothing unsearched can be
+  // nearer than the furthest object kept. The rings start from the point
+  // clamped into the grid: objects outside the world are kept in the edge
+  // cells, and clamping both them and the point to the world only brings
+  // them closer, so the distance from the clamped point to the cells not
+  // yet searched still bounds theirs.
+  void queryNearest(sf::Vector2f point, uint32_t count, float max_distance,
+                    std::vector<SpatialHit> &hits) const {
+    if (!count || ids.empty() || std::isnan(point.x) || std::isnan(point.y))
+      return;
+    const uint32_t first = hits.size();
+    const float limit = max_distance > 0.0f
+                            ? max_distance
+                            : std::numeric_limits<float>::infinity();
+    const sf::Vector2f clamped{std::clamp(point.x, 0.0f, width * cell_size),
+                               std::clamp(point.y, 0.0f, height * cell_size)};
+    const sf::Vector2i centre = getCell(clamped);
+    const int32_t max_ring = std::max(
+        {centre.x, width - 1 - centre.x, centre.y, height - 1 - centre.y});
+    for (int32_t ring = 0; ring <= max_ring; ring++) {
+      const float searched = getSearchedDistance(clamped, centre, ring);
+      if (hits.size() - first == count &&
+          hits[first].distance <= searched)
+        break;
+      if (searched > limit)
+        break;
+      forEachInRing(centre, ring, [&](uint32_t slot) {
+        const sf::Vector2f offset = positions[slot] - point;
+        const float distance =
+            std::sqrt(offset.x * offset.x + offset.y * offset.y);
+        if (distance > limit)
+          return;
+        const SpatialHit hit{ids[slot], distance};
+        if (hits.size() - first < count) {
+          hits.push_back(hit);
+          std::push_heap(hits.begin() + first, hits.end(), nearerHit);
+        } else if (nearerHit(hit, hits[first])) {
+          std::pop_heap(hits.begin() + first, hits.end(), nearerHit);
+          hits.back() = hit;
+          std::push_heap(hits.begin() + first, hits.end(), nearerHit);
+        }
+      });
+    }
+    std::sort_heap(hits.begin() + first, hits.end(), nearerHit);
+  }
+
+  // Objects the segment passes through, nearest the start first. With a
+  // positive max_hits, the walk along the segment stops as soon as no
+  // object further along could be nearer than the ones found.
+  void queryRay(sf::Vector2f start, sf::Vector2f end, uint32_t max_hits,
+                std::vector<SpatialHit> &hits) const {
+    const uint32_t first = hits.size();
+    const sf::Vector2f delta = end - start;
+    const float length = std::sqrt(delta.x * delta.x + delta.y * delta.y);
+    const sf::Vector2f direction =
+        length > 0.0f ? delta / length : sf::Vector2f{1.0f, 0.0f};
+    // Neighbourhoods of consecutive cells overlap, so each cell is stamped
+    // when it is first searched.
+    thread_local std::vector<uint32_t> cell_stamps;
+    thread_local uint32_t stamp = 0;
+    if (cell_stamps.size() < cell_offsets.size() || ++stamp == 0) {
+      cell_stamps.assign(cell_offsets.size(), 0);
+      stamp = 1;
+    }
+    // Every cell within reach of a cell on the segment can hold an object
+    // that touches it; an object in a cell first reached at distance t along
+    // the walk cannot be touched before t minus the width of that reach.
+    const float reach_distance = (reach + 1) * cell_size * 1.4142136f;
+    walkCells(start, direction, length, [&](sf::Vector2i cell, float entered) {
+      if (max_hits && hits.size() - first >= max_hits) {
+        std::sort(hits.begin() + first, hits.end(), nearerHit);
+        if (hits[first + max_hits - 1].distance < entered - reach_distance)
+          return false;
+      }
+      // Objects outside the world are kept in the nearest edge cell, so the
+      // neighbourhood is clamped to the grid rather than cut off by it.
+      const int32_t x_last = std::clamp(cell.x + reach, 0, width - 1);
+      const int32_t y_first = std::clamp(cell.y - reach, 0, height - 1);
+      const int32_t y_last = std::clamp(cell.y + reach, 0, height - 1);
+      for (int32_t x = std::clamp(cell.x - reach, 0, width - 1); x <= x_last;
+           x++) {
+        for (int32_t y = y_first; y <= y_last; y++) {
+          const uint32_t cell_id = x * height + y;
+          if (cell_stamps[cell_id] == stamp)
+            continue;
+          cell_stamps[cell_id] = stamp;
+          for (uint32_t slot = cell_offsets[cell_id];
+               slot < cell_offsets[cell_id + 1]; slot++) {
+            float distance;
+            if (intersectSegment(start, direction, length, positions[slot],
+                                 radii[slot], distance)) {
+              hits.push_back({ids[slot], distance});
+            }
+          }
+        }
+      }
+      return true;
+    });
+    std::sort(hits.begin() + first, hits.end(), nearerHit);
+    if (max_hits && hits.size() - first > max_hits) {
+      hits.resize(first + max_hits);
+    }
+  }
+
+  void query(const SpatialQuery &query, std::vector<SpatialHit> &hits) const {
+    switch (query.type) {
+    case SpatialQuery::Radius:
+      queryRadius(query.point, query.radius, hits);
+      break;
+    case SpatialQuery::Box:
+      queryBox(query.point, query.end, hits);
+      break;
+    case SpatialQuery::Nearest:
+      queryNearest(query.point, query.count, query.radius, hits);
+      break;
+    case SpatialQuery::Ray:
+      queryRay(query.point, query.end, query.count, hits);
+      break;
+    }
+  }
+
+private:
+  float cell_size = 1.0f;
+  float inverse_cell_size = 1.0f;
+  int32_t width = 0;
+  int32_t height = 0;
+  float max_radius = 0.0f;
+  int32_t reach = 0;
+  uint64_t built_frame = UINT64_MAX;
+  uint32_t built_object_count = 0;
+  // Objects in cell c are in slots [cell_offsets[c], cell_offsets[c + 1]).
+  std::vector<uint32_t> cell_offsets{0u};
+  std::vector<uint32_t> ids;
+  std::vector<sf::Vector2f> positions;
+  std::vector<float> radii;
+  std::vector<uint32_t> object_cells;
+  std::vector<uint32_t> cursor;
+
+  static bool nearerHit(const SpatialHit &hit_1, const SpatialHit &hit_2) {
+    return hit_1.distance < hit_2.distance ||
+           (hit_1.distance == hit_2.distance && hit_1.object < hit_2.object);
+  }
+
+  sf::Vector2i getUnclampedCell(sf::Vector2f position) const {
+    return {static_cast<int32_t>(std::floor(position.x * inverse_cell_size)),
+            static_cast<int32_t>(std::floor(position.y * inverse_cell_size))};
+  }
+
+  // Objects outside the world, or not yet moved back inside it, go in the
+  // nearest edge cell.
+  sf::Vector2i getCell(sf::Vector2f position) const {
+    const sf::Vector2i cell = getUnclampedCell(position);
+    return {std::clamp(cell.x, 0, width - 1),
+            std::clamp(cell.y, 0, height - 1)};
+  }
+
+  // How far the point, in the centre cell, is from the nearest cell outside
+  // the rings before this one. Sides at the edge of the grid have nothing
+  // beyond them.
+  float getSearchedDistance(sf::Vector2f point, sf::Vector2i centre,
+                            int32_t ring) const {
+    if (!ring)
+      return 0.0f;
+    float distance = std::numeric_limits<float>::max();
+    if (centre.x - ring >= 0)
+      distance =
+          std::min(distance, point.x - (centre.x - ring + 1) * cell_size);
+    if (centre.x + ring < width)
+      distance = std::min(distance, (centre.x + ring) * cell_size - point.x);
+    if (centre.y - ring >= 0)
+      distance =
+          std::min(distance, point.y - (centre.y - ring + 1) * cell_size);
+    if (centre.y + ring < height)
+      distance = std::min(distance, (centre.y + ring) * cell_size - point.y);
+    return std::max(distance, 0.0f);
+  }
+
+  template <typename SlotCallback>
+  void forEachInBox(sf::Vector2f min, sf::Vector2f max,
+                    SlotCallback &&callback) const {
+    if (!(min.x <= max.x && min.y <= max.y))
+      return;
+    const sf::Vector2i first = getCell(min);
+    const sf::Vector2i last = getCell(max);
+    for (int32_t x = first.x; x <= last.x; x++) {
+      const uint32_t column = x * height;
+      for (uint32_t slot = cell_offsets[column + first.y];
+           slot < cell_offsets[column + last.y + 1]; slot++) {
+        callback(slot);
+      }
+    }
+  }
+
+  // The cells at exactly ring steps from centre in either axis.
+  template <typename SlotCallback>
+  void forEachInRing(sf::Vector2i centre, int32_t ring,
+                     SlotCallback &&callback) const {
+    const auto visitColumn = [&](int32_t x, int32_t y_first, int32_t y_last) {
+      if (x < 0 || x >= width)
+        return;
+      y_first = std::max(y_first, 0);
+      y_last = std::min(y_last, height - 1);
+      if (y_first > y_last)
+        return;
+      for (uint32_t slot = cell_offsets[x * height + y_first];
+           slot < cell_offsets[x * height + y_last + 1]; slot++) {
+        callback(slot);
+      }
+    };
+    if (!ring) {
+      visitColumn(centre.x, centre.y, centre.y);
+      return;
+    }
+    visitColumn(centre.x - ring, centre.y - ring, centre.y + ring);
+    visitColumn(centre.x + ring, centre.y - ring, centre.y + ring);
+    for (int32_t x = centre.x - ring + 1; x < centre.x + ring; x++) {
+      visitColumn(x, centre.y - ring, centre.y - ring);
+      visitColumn(x, centre.y + ring, centre.y + ring);
+    }
+  }
+
+  // Visits the cells the segment passes through in order, with the distance
+  // along it at which each is entered, until callback returns false.
+  template <typename CellCallback>
+  void walkCells(sf::Vector2f start, sf::Vector2f direction, float length,
+                 CellCallback &&callback) const {
+    sf::Vector2i cell = getUnclampedCell(start);
+    const sf::Vector2i step{direction.x >= 0.0f ? 1 : -1,
+                            direction.y >= 0.0f ? 1 : -1};
+    const float infinity = std::numeric_limits<float>::infinity();
+    const sf::Vector2f delta{
+        direction.x != 0.0f ? cell_size / std::fabs(direction.x) : infinity,
+        direction.y != 0.0f ? cell_size / std::fabs(direction.y) : infinity};
+    sf::Vector2f next{
+        direction.x != 0.0f
+            ? ((cell.x + (step.x > 0)) * cell_size - start.x) / direction.x
+            : infinity,
+        direction.y != 0.0f
+            ? ((cell.y + (step.y > 0)) * cell_size - start.y) / direction.y
+            : infinity};
+    float entered = 0.0f;
+    // A segment crosses at most two cell boundaries per cell of length.
+    const int64_t max_cells =
+        static_cast<int64_t>(2.0f * length * inverse_cell_size) + 2;
+    for (int64_t visited = 0; visited <= max_cells; visited++) {
+      if (!callback(cell, entered))
+        return;
+      entered = std::min(next.x, next.y);
+      if (entered > length)
+        return;
+      if (next.x < next.y) {
+        cell.x += step.x;
+        next.x += delta.x;
+      } else {
+        cell.y += step.y;
+        next.y += delta.y;
+      }
+    }
+  }
+
+  // Where along the segment it first touches the circle; a segment starting
+  // inside the circle touches it at 0.
+  static bool intersectSegment(sf::Vector2f start, sf::Vector2f direction,
+                               float length, sf::Vector2f centre, float radius,
+                               float &distance) {
+    const sf::Vector2f offset = start - centre;
+    const float b = offset.x * direction.x + offset.y * direction.y;
+    const float c = offset.x * offset.x + offset.y * offset.y - radius * radius;
+    if (c <= 0.0f) {
+      distance = 0.0f;
+      return true;
+    }
+    const float discriminant = b * b - c;
+    if (discriminant < 0.0f || b > 0.0f)
+      return false;
+    distance = -b - std::sqrt(discriminant);
+    return distance <= length;
+  }
+};
+
+// Many queries answered at once on the thread pool. Chunks of queries go
+// to whichever worker is free, since their costs vary a lot, and the hits
+// for query i end up in hits[offsets[i], offsets[i + 1]).
+struct SpatialQueryBatch {
+  std::vector<SpatialQuery> queries;
+  std::vector<uint32_t> offsets;
+  std::vector<SpatialHit> hits;
+
+  void clear() { queries.clear(); }
+
+  void add(const SpatialQuery &query) { queries.push_back(query); }
+
+  void run(const SpatialIndex &index, tp::ThreadPool &thread_pool) {
+    const uint32_t chunk_count =
+        (queries.size() + SPATIAL_QUERY_CHUNK - 1) / SPATIAL_QUERY_CHUNK;
+    if (chunk_hits.size() < chunk_count) {
+      chunk_hits.resize(chunk_count);
+    }
+    offsets.assign(queries.size() + 1, 0);
+    for (uint32_t chunk = 0; chunk < chunk_count; chunk++) {
+      thread_pool.enqueueTask([this, &index, chunk] {
+        std::vector<SpatialHit> &local = chunk_hits[chunk];
+        local.clear();
+        const uint32_t end = std::min<uint32_t>(
+            (chunk + 1) * SPATIAL_QUERY_CHUNK, queries.size());
+        for (uint32_t idx = chunk * SPATIAL_QUERY_CHUNK; idx < end; idx++) {
+          const uint32_t before = local.size();
+          index.query(queries[idx], local);
+          offsets[idx + 1] = local.size() - before;
+        }
+      });
+    }
+    thread_pool.completeAllTasks();
+    for (uint32_t idx = 0; idx < queries.size(); idx++) {
+      offsets[idx + 1] += offsets[idx];
+    }
+    hits.resize(offsets.back());
+    for (uint32_t chunk = 0; chunk < chunk_count; chunk++) {
+      std::copy(chunk_hits[chunk].begin(), chunk_hits[chunk].end(),
+                hits.begin() + offsets[chunk * SPATIAL_QUERY_CHUNK]);
+    }
+  }
+
+  const SpatialHit *beginHits(uint32_t query) const {
+    return hits.data() + offsets[query];
+  }
+
+  const SpatialHit *endHits(uint32_t query) const {
+    return hits.data() + offsets[query + 1];
+  }
+
+private:
+  std::vector<std::vector<SpatialHit>> chunk_hits;
+};
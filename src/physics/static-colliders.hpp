@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "verlet.hpp"
+
+constexpr uint32_t STATIC_SHAPE_INVALID = 0xFFFFFFFF;
+
+enum class StaticShapeType : uint8_t {
+  Capsule, // Two vertices; a radius of zero makes it a plain segment.
+  Polygon, // Three or more vertices of a convex polygon.
+};
+
+// A shape's vertices are vertex_count consecutive entries of the set's
+// vertex list, polygons wound so that each edge's normal points outwards.
+struct StaticShape {
+  StaticShapeType type = StaticShapeType::Capsule;
+  uint32_t first_vertex = 0;
+  uint32_t vertex_count = 0;
+  float radius = 0.0f;
+  sf::Vector2f min = {0.0f, 0.0f};
+  sf::Vector2f max = {0.0f, 0.0f};
+};
+
+// Level geometry that particles collide with but that never moves, kept out
+// of the object list and the collision grid. Shapes are binned into cells of
+// the collision grid's size whenever one is added or removed, never while
+// stepping, so each particle only tests the shapes near its own cell and
+// costs a single lookup where there is no geometry. Binning assumes no
+// particle is wider than a cell, as the collision grid does. Ids stay valid
+// until the shape is removed.
+struct StaticColliderSet {
+  StaticColliderSet(sf::Vector2f size, float cell_size)
+      : cell_size{cell_size},
+        width{std::max(1, static_cast<int32_t>(size.x / cell_size + 1))},
+        height{std::max(1, static_cast<int32_t>(size.y / cell_size + 1))} {
+    rebuild();
+  }
+
+  uint32_t addCapsule(sf::Vector2f a, sf::Vector2f b, float radius) {
+    StaticShape shape;
+    shape.type = StaticShapeType::Capsule;
+    shape.radius = std::max(radius, 0.0f);
+    const sf::Vector2f edge = b - a;
+    const float length = std::sqrt(edge.x * edge.x + edge.y * edge.y);
+    const sf::Vector2f normal = length ? sf::Vector2f{edge.y, -edge.x} / length
+                                       : sf::Vector2f{0.0f, -1.0f};
+    return add(shape, {a, b}, {normal, -normal});
+  }
+
+  // Returns STATIC_SHAPE_INVALID unless the points, in either winding, make
+  // a convex polygon with three or more distinct corners.
+  uint32_t addPolygon(const std::vector<sf::Vector2f> &points) {
+    std::vector<sf::Vector2f> corners;
+    for (const sf::Vector2f point : points) {
+      if (corners.empty() || point != corners.back()) {
+        corners.push_back(point);
+      }
+    }
+    while (corners.size() > 1 && corners.front() == corners.back()) {
+      corners.pop_back();
+    }
+    if (corners.size() < 3)
+      return STATIC_SHAPE_INVALID;
+    float area = 0.0f;
+    for (uint32_t idx = 0; idx < corners.size(); idx++) {
+      area += cross(corners[idx], corners[(idx + 1) % corners.size()]);
+    }
+    if (area < 0.0f) {
+      std::reverse(corners.begin(), corners.end());
+    } else if (area == 0.0f) {
+      return STATIC_SHAPE_INVALID;
+    }
+    std::vector<sf::Vector2f> normals(corners.size());
+    for (uint32_t idx = 0; idx < corners.size(); idx++) {
+      const sf::Vector2f a = corners[idx];
+      const sf::Vector2f b = corners[(idx + 1) % corners.size()];
+      const sf::Vector2f c = corners[(idx + 2) % corners.size()];
+      if (cross(b - a, c - b) < 0.0f)
+        return STATIC_SHAPE_INVALID;
+      const sf::Vector2f edge = b - a;
+      normals[idx] = sf::Vector2f{edge.y, -edge.x} /
+                     std::sqrt(edge.x * edge.x + edge.y * edge.y);
+    }
+    StaticShape shape;
+    shape.type = StaticShapeType::Polygon;
+    return add(shape, corners, normals);
+  }
+
+  void remove(uint32_t id) {
+    if (id >= shapes.size() || !in_use[id])
+      return;
+    in_use[id] = false;
+    free_ids.push_back(id);
+    rebuild();
+  }
+
+  bool empty() const { return active_count == 0; }
+
+  uint32_t getShapeCount() const { return active_count; }
+
+  // Every id up to getShapeCapacity() is either in use or free.
+  uint32_t getShapeCapacity() const { return shapes.size(); }
+
+  bool isInUse(uint32_t id) const { return id < shapes.size() && in_use[id]; }
+
+  const StaticShape &get(uint32_t id) const { return shapes[id]; }
+
+  const sf::Vector2f *getVertices(uint32_t id) const {
+    return vertices.data() + shapes[id].first_vertex;
+  }
+
+  // Changes whenever a shape is added or removed, for anything caching the
+  // geometry.
+  uint32_t getVersion() const { return version; }
+
+  // Moves the particle out of every shape near its cell that it overlaps,
+  // and returns how many that was. The shapes are immovable, so the whole
+  // overlap is corrected at once: a partial push, as between particles,
+  // would let a fast particle work its way through a thin segment.
+  uint32_t collide(VerletObject &object) const {
+    if (!active_count)
+      return 0;
+    const sf::Vector2f position = object.curr_position;
+    const int32_t x = std::min(std::max(getCellX(position.x), 0), width - 1);
+    const int32_t y = std::min(std::max(getCellY(position.y), 0), height - 1);
+    const int32_t cell = x * height + y;
+    uint32_t contacts = 0;
+    for (uint32_t idx = cell_offsets[cell]; idx < cell_offsets[cell + 1];
+         idx++) {
+      const StaticShape &shape = shapes[cell_shapes[idx]];
+      const float reach = shape.radius + object.radius;
+      const sf::Vector2f &current = object.curr_position;
+      if (current.x <= shape.min.x - reach ||
+          current.x >= shape.max.x + reach ||
+          current.y <= shape.min.y - reach ||
+          current.y >= shape.max.y + reach)
+        continue;
+      contacts += shape.type == StaticShapeType::Capsule
+                      ? collideCapsule(shape, object)
+                      : collidePolygon(shape, object);
+    }
+    return contacts;
+  }
+
+private:
+  float cell_size;
+  int32_t width;
+  int32_t height;
+  std::vector<StaticShape> shapes;
+  std::vector<bool> in_use;
+  std::vector<uint32_t> free_ids;
+  std::vector<sf::Vector2f> vertices;
+  // normals[i] is the outward normal of the edge from vertex i to the next.
+  std::vector<sf::Vector2f> normals;
+  uint32_t active_count = 0;
+  uint32_t version = 0;
+  std::vector<uint32_t> cell_offsets;
+  std::vector<uint32_t> cell_shapes;
+
+  // Clamped to one cell beyond the grid before the cast, so positions far
+  // off the grid, or not a number, still convert.
+  int32_t getCellX(float x) const {
+    return static_cast<int32_t>(
+        std::min(std::max(-1.0f, std::floor(x / cell_size)),
+                 static_cast<float>(width)));
+  }
+
+  int32_t getCellY(float y) const {
+    return static_cast<int32_t>(
+        std::min(std::max(-1.0f, std::floor(y / cell_size)),
+                 static_cast<float>(height)));
+  }
+
+  static float cross(sf::Vector2f a, sf::Vector2f b) {
+    return a.x * b.y - a.y * b.x;
+  }
+
+  static float dot(sf::Vector2f a, sf::Vector2f b) {
+    return a.x * b.x + a.y * b.y;
+  }
+
+  static sf::Vector2f closestOnSegment(sf::Vector2f point, sf::Vector2f a,
+                                       sf::Vector2f b) {
+    const sf::Vector2f edge = b - a;
+    const float square_length = dot(edge, edge);
+    if (!square_length)
+      return a;
+    const float t =
+        std::min(std::max(dot(point - a, edge) / square_length, 0.0f), 1.0f);
+    return a + t * edge;
+  }
+
+  // Pushes the particle to min_distance from the point displacement away
+  // from it, along fallback when the two coincide.
+  static bool pushOut(VerletObject &object, sf::Vector2f displacement,
+                      float min_distance, sf::Vector2f fallback) {
+    const float square_distance = dot(displacement, displacement);
+    if (square_distance >= min_distance * min_distance)
+      return false;
+    const float distance = std::sqrt(square_distance);
+    const sf::Vector2f normal =
+        distance > 0.0f ? displacement / distance : fallback;
+    object.curr_position += normal * (min_distance - distance);
+    return true;
+  }
+
+  // A thin shape can be crossed in one substep by a particle squeezed from
+  // behind, after which the nearest point would push it out the far side,
+  // so a particle whose centre crossed the axis since its last position is
+  // sent back to the side it came from.
+  bool collideCapsule(const StaticShape &shape, VerletObject &object) const {
+    const sf::Vector2f a = vertices[shape.first_vertex];
+    const sf::Vector2f b = vertices[shape.first_vertex + 1];
+    const sf::Vector2f normal = normals[shape.first_vertex];
+    const float last_side = dot(object.last_position - a, normal);
+    const float side = dot(object.curr_position - a, normal);
+    if ((last_side > 0.0f) != (side > 0.0f)) {
+      const float crossing = last_side / (last_side - side);
+      const sf::Vector2f point =
+          object.last_position +
+          crossing * (object.curr_position - object.last_position);
+      const sf::Vector2f edge = b - a;
+      const float t = dot(point - a, edge);
+      if (t >= 0.0f && t <= dot(edge, edge)) {
+        const sf::Vector2f back = last_side > 0.0f ? normal : -normal;
+        object.curr_position +=
+            back * (std::abs(side) + shape.radius + object.radius);
+        return true;
+      }
+    }
+    const sf::Vector2f closest = closestOnSegment(object.curr_position, a, b);
+    return pushOut(object, object.curr_position - closest,
+                   shape.radius + object.radius, normal);
+  }
+
+  // A particle whose centre is inside leaves through the nearest edge;
+  // otherwise it is pushed away from the nearest point on the outline.
+  bool collidePolygon(const StaticShape &shape, VerletObject &object) const {
+    const sf::Vector2f position = object.curr_position;
+    const uint32_t first = shape.first_vertex;
+    const uint32_t last = first + shape.vertex_count;
+    float max_separation = -std::numeric_limits<float>::infinity();
+    uint32_t max_edge = first;
+    for (uint32_t idx = first; idx < last; idx++) {
+      const float separation = dot(position - vertices[idx], normals[idx]);
+      if (separation > max_separation) {
+        max_separation = separation;
+        max_edge = idx;
+      }
+    }
+    if (max_separation >= object.radius)
+      return false;
+    if (max_separation <= 0.0f) {
+      object.curr_position +=
+          normals[max_edge] * (object.radius - max_separation);
+      return true;
+    }
+    sf::Vector2f closest = vertices[first];
+    float closest_square_distance = std::numeric_limits<float>::infinity();
+    for (uint32_t idx = first; idx < last; idx++) {
+      const sf::Vector2f next = vertices[idx + 1 < last ? idx + 1 : first];
+      const sf::Vector2f point =
+          closestOnSegment(position, vertices[idx], next);
+      const sf::Vector2f displacement = position - point;
+      const float square_distance = dot(displacement, displacement);
+      if (square_distance < closest_square_distance) {
+        closest_square_distance = square_distance;
+        closest = point;
+      }
+    }
+    return pushOut(object, position - closest, object.radius,
+                   normals[max_edge]);
+  }
+
+  uint32_t add(StaticShape shape, const std::vector<sf::Vector2f> &points,
+               const std::vector<sf::Vector2f> &edge_normals) {
+    shape.first_vertex = vertices.size();
+    shape.vertex_count = points.size();
+    shape.min = shape.max = points.front();
+    for (const sf::Vector2f point : points) {
+      shape.min = {std::min(shape.min.x, point.x),
+                   std::min(shape.min.y, point.y)};
+      shape.max = {std::max(shape.max.x, point.x),
+                   std::max(shape.max.y, point.y)};
+    }
+    vertices.insert(vertices.end(), points.begin(), points.end());
+    normals.insert(normals.end(), edge_normals.begin(), edge_normals.end());
+    uint32_t id = shapes.size();
+    if (!free_ids.empty()) {
+      id = free_ids.back();
+      free_ids.pop_back();
+      shapes[id] = shape;
+      in_use[id] = true;
+    } else {
+      shapes.push_back(shape);
+      in_use.push_back(true);
+    }
+    rebuild();
+    return id;
+  }
+
+  // Drops the vertices of removed shapes, then counts and fills a
+  // compressed list of shape ids per cell. Each shape goes in every cell
+  // within a cell's width of its bounds, which covers any particle centred
+  // in the cell that could touch it.
+  void rebuild() {
+    version++;
+    std::vector<sf::Vector2f> kept_vertices;
+    std::vector<sf::Vector2f> kept_normals;
+    active_count = 0;
+    for (uint32_t id = 0; id < shapes.size(); id++) {
+      if (!in_use[id])
+        continue;
+      active_count++;
+      StaticShape &shape = shapes[id];
+      kept_vertices.insert(kept_vertices.end(),
+                           vertices.begin() + shape.first_vertex,
+                           vertices.begin() + shape.first_vertex +
+                               shape.vertex_count);
+      kept_normals.insert(kept_normals.end(),
+                          normals.begin() + shape.first_vertex,
+                          normals.begin() + shape.first_vertex +
+                              shape.vertex_count);
+      shape.first_vertex = kept_vertices.size() - shape.vertex_count;
+    }
+    vertices.swap(kept_vertices);
+    normals.swap(kept_normals);
+
+    cell_offsets.assign(width * height + 1, 0);
+    const auto forEachCell = [&](const StaticShape &shape, auto &&callback) {
+      const float reach = shape.radius + cell_size;
+      const int32_t min_x = std::max(getCellX(shape.min.x - reach), 0);
+      const int32_t max_x = std::min(getCellX(shape.max.x + reach), width - 1);
+      const int32_t min_y = std::max(getCellY(shape.min.y - reach), 0);
+      const int32_t max_y = std::min(getCellY(shape.max.y + reach), height - 1);
+      for (int32_t x = min_x; x <= max_x; x++) {
+        for (int32_t y = min_y; y <= max_y; y++) {
+          callback(x * height + y);
+        }
+      }
+    };
+    for (uint32_t id = 0; id < shapes.size(); id++) {
+      if (!in_use[id])
+        continue;
+      forEachCell(shapes[id], [&](int32_t cell) { cell_offsets[cell + 1]++; });
+    }
+    for (uint32_t cell = 0; cell < width * height; cell++) {
+      cell_offsets[cell + 1] += cell_offsets[cell];
+    }
+    cell_shapes.resize(cell_offsets.back());
+    std::vector<uint32_t> cursor(cell_offsets.begin(), cell_offsets.end() - 1);
+    for (uint32_t id = 0; id < shapes.size(); id++) {
+      if (!in_use[id])
+        continue;
+      forEachCell(shapes[id],
+                  [&](int32_t cell) { cell_shapes[cursor[cell]++] = id; });
+    }
+  }
+};
@@ -1,16 +1,49 @@
 #pragma once
 
+#include <memory>
+#include <utility>
+#include <vector>
+
 constexpr uint8_t CELL_CAPACITY = 4;
 
+// Default-initialises instead of value-initialising, so resizing a vector of
+// trivial cells leaves the memory untouched until something first writes
+// it. That lets whichever thread writes a cell first decide which NUMA node
+// its page lives on.
+template<typename T>
+struct DefaultInitAllocator : std::allocator<T> {
+    template<typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U>;
+    };
+
+    DefaultInitAllocator() = default;
+
+    template<typename U>
+    DefaultInitAllocator(const DefaultInitAllocator<U>&) {}
+
+    template<typename U>
+    void construct(U *pointer) {
+        ::new (static_cast<void*>(pointer)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U *pointer, Args&&... args) {
+        ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+    }
+};
+
 struct CollisionCell {
     uint32_t object_count;
     uint32_t objects[CELL_CAPACITY];
 
     CollisionCell() = default;
 
-    void addObject(uint32_t object_id) {
+    bool addObject(uint32_t object_id) {
+        const bool stored = object_count < (CELL_CAPACITY - 1);
         objects[object_count] = object_id;
-        object_count += object_count < (CELL_CAPACITY - 1);
+        object_count += stored;
+        return stored;
     }
 
     void clear() {
@@ -27,8 +60,11 @@ struct CollisionCell {
     }
 };
 
+using CellStorage =
+    std::vector<CollisionCell, DefaultInitAllocator<CollisionCell>>;
+
 struct UniformCollisionGrid {
-    std::vector<CollisionCell> cells;
+    CellStorage cells;
     int32_t width, height;
 
     UniformCollisionGrid()
@@ -41,15 +77,21 @@ struct UniformCollisionGrid {
         , height{height}
     {
         cells.resize(width * height);
+        clear();
     }
 
-    void addObject(uint32_t x, uint32_t y, uint32_t object_id) {
+    bool addObject(uint32_t x, uint32_t y, uint32_t object_id) {
         const uint32_t idx = x * height + y;
-        cells[idx].addObject(object_id);
+        return cells[idx].addObject(object_id);
     }
 
     void clear() {
-        cells.clear();
-        cells.resize(width * height);
+        clearColumns(0, width);
+    }
+
+    void clearColumns(int32_t first, int32_t last) {
+        for (int32_t idx=first*height; idx<last*height; idx++) {
+            cells[idx].clear();
+        }
     }
 };
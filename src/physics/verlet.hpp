@@ -55,37 +55,51 @@ struct VerletObject {
   }
 };
 
+// An XPBD distance constraint. Compliance is the inverse stiffness in
+// pixels per unit force: zero is perfectly rigid, and because it is scaled
+// by the substep length, a given compliance is equally stiff at any
+// substep count. lambda accumulates over the iterations of one substep.
 struct VerletConstraint {
   VerletObject &object_1;
   VerletObject &object_2;
   float target_distance;
-  bool in_body;
+  float compliance = 0.0f;
+  float lambda = 0.0f;
+  bool in_body = false;
+  bool in_chain = false;
 
   VerletConstraint(VerletObject &object_1, VerletObject &object_2,
-                   float target_distance)
+                   float target_distance, float compliance = 0.0f)
       : object_1{object_1}, object_2{object_2},
-        target_distance{target_distance} {}
+        target_distance{target_distance}, compliance{compliance} {}
 
-  void apply() {
+  // Returns the absolute XPBD residual before the correction: the length
+  // error, less the stretch the compliance allows for the current lambda.
+  float apply(float dt) {
     if (object_1.fixed && object_2.fixed)
-      return;
+      return 0.0f;
     const sf::Vector2f displacement =
         object_1.curr_position - object_2.curr_position;
     const float distance =
         sqrt(displacement.x * displacement.x + displacement.y * displacement.y);
+    if (!distance)
+      return 0.0f;
     const sf::Vector2f normal = displacement / distance;
-    const float delta = target_distance - distance;
-    if (object_1.fixed && !object_2.fixed) {
-      object_2.curr_position -= delta * normal;
-    } else if (!object_1.fixed && object_2.fixed) {
-      object_1.curr_position += delta * normal;
-    } else {
-      object_1.curr_position += 0.5f * delta * normal;
-      object_2.curr_position -= 0.5f * delta * normal;
-    }
+    const float error = distance - target_distance;
+    const float weight_1 = object_1.fixed ? 0.0f : 1.0f;
+    const float weight_2 = object_2.fixed ? 0.0f : 1.0f;
+    const float scaled_compliance = compliance / (dt * dt);
+    const float residual = error + scaled_compliance * lambda;
+    const float delta_lambda =
+        -residual / (weight_1 + weight_2 + scaled_compliance);
+    lambda += delta_lambda;
+    object_1.curr_position += weight_1 * delta_lambda * normal;
+    object_2.curr_position -= weight_2 * delta_lambda * normal;
+    return std::abs(residual);
   }
 };
 
+// Pressure is solved by SoftBodySolver; this keeps the outline for drawing.
 struct VerletSoftBody {
   std::vector<VerletObject *> vertices;
   std::vector<VerletConstraint *> segments;
@@ -98,42 +112,55 @@ struct VerletSoftBody {
     points = vertices.size();
     desired_area = M_PI * radius * radius;
   }
+};
+
+// Shape matching: each apply() finds the rotation and translation that best
+// fit the rest shape to the current vertices, then moves every vertex
+// exactly onto the fitted shape, so the body never flexes.
+struct VerletRigidBody {
+  std::vector<VerletObject *> vertices;
+  std::vector<sf::Vector2f> rest_offsets;
+  int32_t points;
+
+  explicit VerletRigidBody(std::vector<VerletObject *> vertices)
+      : vertices{vertices} {
+    points = vertices.size();
+    const sf::Vector2f centre = getCentre();
+    rest_offsets.reserve(points);
+    for (const VerletObject *vertex : vertices) {
+      rest_offsets.push_back(vertex->curr_position - centre);
+    }
+  }
 
   void apply() {
-    float current_area;
-    float area = 0.0f;
-    int32_t points = vertices.size();
+    if (!points)
+      return;
+    const sf::Vector2f centre = getCentre();
+    float dot = 0.0f;
+    float cross = 0.0f;
     for (int32_t i = 0; i < points; i++) {
-      const sf::Vector2f &vertex1 = vertices[i]->curr_position;
-      const sf::Vector2f &vertex2 = vertices[(i + 1) % points]->curr_position;
-      area += vertex1.x * vertex2.y - vertex2.x * vertex1.y;
+      const sf::Vector2f &rest = rest_offsets[i];
+      const sf::Vector2f offset = vertices[i]->curr_position - centre;
+      dot += rest.x * offset.x + rest.y * offset.y;
+      cross += rest.x * offset.y - rest.y * offset.x;
     }
-    current_area = std::abs(area) / 2.0f;
-
-    float area_error = desired_area - current_area;
-    float delta = area_error / (points * 2.0f);
+    const float magnitude = sqrt(dot * dot + cross * cross);
+    const float cos_angle = magnitude ? dot / magnitude : 1.0f;
+    const float sin_angle = magnitude ? cross / magnitude : 0.0f;
     for (int32_t i = 0; i < points; i++) {
-      int32_t prev_idx = (i == 0) ? points - 1 : i - 1;
-      int32_t next_idx = (i == points - 1) ? 0 : i + 1;
-      sf::Vector2f prev_point = vertices[prev_idx]->curr_position;
-      sf::Vector2f next_point = vertices[next_idx]->curr_position;
-      sf::Vector2f normal = next_point - prev_point;
-      normal = sf::Vector2f(-normal.y, normal.x);
-      normal /= sqrt(normal.x * normal.x + normal.y * normal.y);
-      vertices[i]->curr_position += 0.01f * normal * delta;
+      const sf::Vector2f &rest = rest_offsets[i];
+      vertices[i]->curr_position =
+          centre + sf::Vector2f(cos_angle * rest.x - sin_angle * rest.y,
+                                sin_angle * rest.x + cos_angle * rest.y);
     }
   }
-};
 
-struct VerletRigidBody {
-  std::vector<VerletObject *> vertices;
-  std::vector<VerletConstraint *> segments;
-  float side_length;
-  int32_t points;
-
-  VerletRigidBody(std::vector<VerletObject *> vertices,
-                  std::vector<VerletConstraint *> segments, float side_length)
-      : vertices{vertices}, segments{segments}, side_length{side_length} {
-    points = vertices.size();
+private:
+  sf::Vector2f getCentre() const {
+    sf::Vector2f centre{0.0f, 0.0f};
+    for (const VerletObject *vertex : vertices) {
+      centre += vertex->curr_position;
+    }
+    return points ? centre / static_cast<float>(points) : centre;
   }
 };
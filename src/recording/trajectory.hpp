@@ -0,0 +1,254 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../renderer/frame.hpp"
+
+constexpr char TRAJECTORY_MAGIC[8] = {'V', 'K', 'T', 'R', 'A', 'J', '0', '1'};
+constexpr uint32_t TRAJECTORY_VERSION = 2;
+
+struct TrajectoryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t frame_count;
+  sf::Vector2f size;
+  float frame_dt;
+  uint32_t padding;
+  uint64_t index_offset;
+};
+
+struct TrajectoryFrameHeader {
+  float time;
+  uint32_t object_count;
+  uint32_t line_count;
+  uint32_t polygon_count;
+  uint32_t polygon_index_count;
+  uint32_t static_line_count;
+};
+
+// Frames are appended as they are produced and a table of frame offsets is
+// written at the end on close, so a reader can seek to any frame in O(1).
+// Every frame carries its own copy of the static collider outlines, which
+// are few enough that this keeps frames independent at little cost.
+struct TrajectoryWriter {
+  TrajectoryWriter(const std::string &path, sf::Vector2f size, float frame_dt)
+      : file{path, std::ios::binary | std::ios::trunc} {
+    std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+    header.version = TRAJECTORY_VERSION;
+    header.frame_count = 0;
+    header.size = size;
+    header.frame_dt = frame_dt;
+    header.padding = 0;
+    header.index_offset = 0;
+    writeRaw(&header, sizeof(header));
+  }
+
+  TrajectoryWriter(const TrajectoryWriter &) = delete;
+  TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+  ~TrajectoryWriter() { close(); }
+
+  bool isOpen() const { return file.is_open() && file.good(); }
+
+  void write(const FrameView &frame) {
+    if (!isOpen())
+      return;
+    frame_offsets.push_back(static_cast<uint64_t>(file.tellp()));
+    const uint32_t polygon_index_count =
+        frame.polygon_count ? frame.polygon_offsets[frame.polygon_count] : 0;
+    const TrajectoryFrameHeader frame_header{
+        frame.time,          frame.object_count,
+        frame.line_count,    frame.polygon_count,
+        polygon_index_count, frame.static_line_count};
+    writeRaw(&frame_header, sizeof(frame_header));
+    writeRaw(frame.objects, frame.object_count * sizeof(FrameObject));
+    writeRaw(frame.lines, 2 * frame.line_count * sizeof(uint32_t));
+    if (frame.polygon_count) {
+      writeRaw(frame.polygon_offsets,
+               (frame.polygon_count + 1) * sizeof(uint32_t));
+      writeRaw(frame.polygon_indices, polygon_index_count * sizeof(uint32_t));
+    }
+    writeRaw(frame.static_lines,
+             2 * frame.static_line_count * sizeof(sf::Vector2f));
+    header.frame_count++;
+  }
+
+  void close() {
+    if (!file.is_open())
+      return;
+    const uint64_t padding = (8 - file.tellp() % 8) % 8;
+    const uint64_t zero = 0;
+    writeRaw(&zero, padding);
+    header.index_offset = static_cast<uint64_t>(file.tellp());
+    writeRaw(frame_offsets.data(), frame_offsets.size() * sizeof(uint64_t));
+    file.seekp(0);
+    writeRaw(&header, sizeof(header));
+    file.close();
+  }
+
+private:
+  std::ofstream file;
+  TrajectoryHeader header;
+  std::vector<uint64_t> frame_offsets;
+
+  void writeRaw(const void *data, uint64_t bytes) {
+    if (bytes) {
+      file.write(static_cast<const char *>(data), bytes);
+    }
+  }
+};
+
+// Read-only view of a recording; the file is memory-mapped so only the pages
+// of the frames actually drawn are ever loaded.
+struct TrajectoryReader {
+  explicit TrajectoryReader(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat status;
+    if (fstat(fd, &status) == 0 &&
+        status.st_size >= static_cast<off_t>(sizeof(TrajectoryHeader))) {
+      file_size = status.st_size;
+      void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        data = static_cast<const uint8_t *>(mapping);
+      }
+    }
+    ::close(fd);
+    if (data && !validate()) {
+      unmap();
+    }
+  }
+
+  TrajectoryReader(const TrajectoryReader &) = delete;
+  TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+  ~TrajectoryReader() { unmap(); }
+
+  bool isOpen() const { return data != nullptr; }
+
+  uint32_t frameCount() const { return isOpen() ? header().frame_count : 0; }
+
+  sf::Vector2f size() const { return header().size; }
+
+  float frameDt() const { return header().frame_dt; }
+
+  uint32_t frameAt(float playback_time) const {
+    if (!frameCount() || playback_time <= 0.0f)
+      return 0;
+    const float index = playback_time / frameDt() + 0.5f;
+    return index < static_cast<float>(frameCount())
+               ? static_cast<uint32_t>(index)
+               : frameCount() - 1;
+  }
+
+  FrameView frame(uint32_t index) const {
+    FrameView view;
+    if (index >= frameCount())
+      return view;
+    const uint64_t offset = frame_offsets[index];
+    if (offset + sizeof(TrajectoryFrameHeader) > header().index_offset)
+      return view;
+    const uint8_t *cursor = data + offset;
+    TrajectoryFrameHeader frame_header;
+    std::memcpy(&frame_header, cursor, sizeof(frame_header));
+    const uint64_t polygon_words =
+        frame_header.polygon_count
+            ? frame_header.polygon_count + 1 + frame_header.polygon_index_count
+            : 0;
+    const uint64_t frame_bytes =
+        sizeof(frame_header) +
+        uint64_t{frame_header.object_count} * sizeof(FrameObject) +
+        (2 * uint64_t{frame_header.line_count} + polygon_words) *
+            sizeof(uint32_t) +
+        2 * uint64_t{frame_header.static_line_count} * sizeof(sf::Vector2f);
+    if (offset + frame_bytes > header().index_offset)
+      return view;
+    cursor += sizeof(frame_header);
+    view.time = frame_header.time;
+    view.object_count = frame_header.object_count;
+    view.objects = reinterpret_cast<const FrameObject *>(cursor);
+    cursor += frame_header.object_count * sizeof(FrameObject);
+    view.line_count = frame_header.line_count;
+    view.lines = reinterpret_cast<const uint32_t *>(cursor);
+    cursor += 2 * frame_header.line_count * sizeof(uint32_t);
+    view.polygon_count = frame_header.polygon_count;
+    if (frame_header.polygon_count) {
+      view.polygon_offsets = reinterpret_cast<const uint32_t *>(cursor);
+      cursor += (frame_header.polygon_count + 1) * sizeof(uint32_t);
+      view.polygon_indices = reinterpret_cast<const uint32_t *>(cursor);
+      cursor += frame_header.polygon_index_count * sizeof(uint32_t);
+    }
+    view.static_line_count = frame_header.static_line_count;
+    view.static_lines = reinterpret_cast<const sf::Vector2f *>(cursor);
+    if (!validateTopology(view, frame_header.polygon_index_count))
+      return FrameView{};
+    return view;
+  }
+
+private:
+  const uint8_t *data = nullptr;
+  uint64_t file_size = 0;
+  const uint64_t *frame_offsets = nullptr;
+
+  const TrajectoryHeader &header() const {
+    return *reinterpret_cast<const TrajectoryHeader *>(data);
+  }
+
+  // A corrupt frame must not send the renderers outside its objects.
+  static bool validateTopology(const FrameView &view,
+                               uint32_t polygon_index_count) {
+    for (uint32_t idx = 0; idx < 2 * view.line_count; idx++) {
+      if (view.lines[idx] >= view.object_count)
+        return false;
+    }
+    if (!view.polygon_count)
+      return true;
+    if (view.polygon_offsets[0] != 0 ||
+        view.polygon_offsets[view.polygon_count] != polygon_index_count)
+      return false;
+    for (uint32_t idx = 0; idx < view.polygon_count; idx++) {
+      if (view.polygon_offsets[idx] > view.polygon_offsets[idx + 1])
+        return false;
+    }
+    for (uint32_t idx = 0; idx < polygon_index_count; idx++) {
+      if (view.polygon_indices[idx] >= view.object_count)
+        return false;
+    }
+    return true;
+  }
+
+  bool validate() {
+    const TrajectoryHeader &file_header = header();
+    if (std::memcmp(file_header.magic, TRAJECTORY_MAGIC,
+                    sizeof(TRAJECTORY_MAGIC)) != 0 ||
+        file_header.version != TRAJECTORY_VERSION ||
+        !(file_header.frame_dt > 0.0f) ||
+        file_header.index_offset % 8 != 0 ||
+        file_header.index_offset +
+                file_header.frame_count * sizeof(uint64_t) >
+            file_size) {
+      return false;
+    }
+    frame_offsets =
+        reinterpret_cast<const uint64_t *>(data + file_header.index_offset);
+    return true;
+  }
+
+  void unmap() {
+    if (data) {
+      munmap(const_cast<uint8_t *>(data), file_size);
+    }
+    data = nullptr;
+    frame_offsets = nullptr;
+  }
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/solver.hpp"
+
+struct FrameObject {
+    sf::Vector2f position;
+    float radius;
+    sf::Color colour;
+};
+
+struct FrameView {
+    float time = 0.0f;
+    const FrameObject *objects = nullptr;
+    uint32_t object_count = 0;
+    const uint32_t *lines = nullptr;
+    uint32_t line_count = 0;
+    const uint32_t *polygon_offsets = nullptr;
+    uint32_t polygon_count = 0;
+    const uint32_t *polygon_indices = nullptr;
+    const sf::Vector2f *previous_positions = nullptr;
+    float alpha = 1.0f;
+    // Pairs of endpoints outlining the static colliders, in pixels.
+    const sf::Vector2f *static_lines = nullptr;
+    uint32_t static_line_count = 0;
+
+    sf::Vector2f getPosition(uint32_t idx) const {
+        const sf::Vector2f &position = objects[idx].position;
+        if (!previous_positions) return position;
+        const sf::Vector2f &previous = previous_positions[idx];
+        return previous + alpha * (position - previous);
+    }
+};
+
+struct FrameSnapshot {
+    float time = 0.0f;
+    std::vector<FrameObject> objects;
+    std::vector<uint32_t> lines;
+    std::vector<uint32_t> polygon_offsets;
+    std::vector<uint32_t> polygon_indices;
+    std::vector<sf::Vector2f> previous_positions;
+    std::vector<sf::Vector2f> static_lines;
+    uint32_t static_version = 0;
+
+    // Remembers where every object is before a step, so that the next
+    // capture can be drawn anywhere between the two states.
+    void capturePrevious(const Solver &solver) {
+        previous_positions.resize(solver.objects.size());
+        for (uint32_t idx=0; idx<solver.objects.size(); idx++) {
+            previous_positions[idx] = solver.objects[idx].curr_position;
+        }
+    }
+
+    void capture(const Solver &solver) {
+        const VerletObject *base = solver.objects.data();
+        time = solver.time;
+        objects.resize(solver.objects.size());
+        for (uint32_t idx=0; idx<solver.objects.size(); idx++) {
+            const VerletObject &object = solver.objects[idx];
+            objects[idx] = {object.curr_position, object.hidden ? 0.0f : object.radius, object.colour};
+        }
+        if (!previous_positions.empty()) {
+            for (uint32_t idx=previous_positions.size(); idx<objects.size(); idx++) {
+                previous_positions.push_back(objects[idx].position);
+            }
+        }
+
+        lines.clear();
+        for (const auto &constraint : solver.constraints) {
+            if (constraint.in_body) continue;
+            lines.push_back(static_cast<uint32_t>(&constraint.object_1 - base));
+            lines.push_back(static_cast<uint32_t>(&constraint.object_2 - base));
+        }
+
+        polygon_offsets.assign(1, 0u);
+        polygon_indices.clear();
+        for (const auto &soft_body : solver.soft_bodies) {
+            addPolygon(soft_body.vertices, base);
+        }
+        for (const auto &rigid_body : solver.rigid_bodies) {
+            addPolygon(rigid_body.vertices, base);
+        }
+
+        const StaticColliderSet &colliders = solver.getStaticColliders();
+        if (colliders.getVersion() != static_version) {
+            captureStaticLines(colliders);
+            static_version = colliders.getVersion();
+        }
+    }
+
+    FrameView view() const {
+        FrameView frame;
+        frame.time = time;
+        frame.objects = objects.data();
+        frame.object_count = objects.size();
+        frame.lines = lines.data();
+        frame.line_count = lines.size() / 2;
+        frame.polygon_offsets = polygon_offsets.data();
+        frame.polygon_count = polygon_offsets.empty() ? 0 : polygon_offsets.size() - 1;
+        frame.polygon_indices = polygon_indices.data();
+        if (previous_positions.size() == objects.size()) {
+            frame.previous_positions = previous_positions.data();
+        }
+        frame.static_lines = static_lines.data();
+        frame.static_line_count = static_lines.size() / 2;
+        return frame;
+    }
+
+private:
+    void addPolygon(const std::vector<VerletObject *> &vertices, const VerletObject *base) {
+        for (const VerletObject *vertex : vertices) {
+            polygon_indices.push_back(static_cast<uint32_t>(vertex - base));
+        }
+        polygon_offsets.push_back(polygon_indices.size());
+    }
+
+    // Capsules are outlined by their two sides, without the rounded ends.
+    void captureStaticLines(const StaticColliderSet &colliders) {
+        static_lines.clear();
+        for (uint32_t id=0; id<colliders.getShapeCapacity(); id++) {
+            if (!colliders.isInUse(id)) continue;
+            const StaticShape &shape = colliders.get(id);
+            const sf::Vector2f *points = colliders.getVertices(id);
+            if (shape.type == StaticShapeType::Polygon) {
+                for (uint32_t i=0; i<shape.vertex_count; i++) {
+                    addStaticLine(points[i], points[(i + 1) % shape.vertex_count]);
+                }
+            } else if (!shape.radius) {
+                addStaticLine(points[0], points[1]);
+            } else {
+                const sf::Vector2f edge = points[1] - points[0];
+                const float length = std::sqrt(edge.x * edge.x + edge.y * edge.y);
+                const sf::Vector2f offset = length ? sf::Vector2f{edge.y, -edge.x} * (shape.radius / length)
+                                                   : sf::Vector2f{0.0f, 0.0f};
+                addStaticLine(points[0] + offset, points[1] + offset);
+                addStaticLine(points[0] - offset, points[1] - offset);
+            }
+        }
+    }
+
+    void addStaticLine(sf::Vector2f start, sf::Vector2f end) {
+        static_lines.push_back(start);
+        static_lines.push_back(end);
+    }
+};
@@ -1,65 +1,133 @@
 #pragma once
 
+#include <cmath>
 #include <iostream>
+#include <string>
 
 #include "../physics/solver.hpp"
+#include "frame.hpp"
 
-constexpr float OUTLINE_THICKNESS = 0.0f;
+constexpr const char *CIRCLE_TEXTURE_PATHS[] = {"res/circle.png", "../res/circle.png"};
+constexpr uint32_t FALLBACK_TEXTURE_SIZE = 128;
 
+// Draws a whole frame in three draw calls: one batch of textured quads for
+// the particles, one of lines for free constraints and static collider
+// outlines, and one of triangles for body outlines. The vertex buffers keep
+// their capacity between frames.
 class Renderer {
 public:
     explicit
     Renderer(sf::RenderTarget &target)
         : target{target}
-    {}
-    void render(const Solver &solver) const {
-        sf::CircleShape circle{1.0f};
-        circle.setPointCount(32);
-        circle.setOrigin(1.0f, 1.0f);
-        int32_t object_id = 0;
-        const auto &objects = solver.objects;
-        for (const auto &object : objects) {
-            if (object.hidden) continue;
-            circle.setPosition(object.curr_position);
-            circle.setScale(object.radius, object.radius);
-            circle.setFillColor(object.colour);
-            circle.setOutlineColor(sf::Color::Black);
-            circle.setOutlineThickness(-OUTLINE_THICKNESS / object.radius);
-            target.draw(circle);
-            object_id++;
-        }
+    {
+        loadCircleTexture();
+    }
+
+    void render(const Solver &solver) {
+        snapshot.capture(solver);
+        render(snapshot.view());
+    }
 
-        sf::Vertex constraint_line[2];
-        const auto &constraints = solver.constraints;
-        for (const auto &constraint : constraints) {
-            if (constraint.in_body) continue;
-            constraint_line[0].position = constraint.object_1.curr_position;
-            constraint_line[1].position = constraint.object_2.curr_position;
-            constraint_line[0].color = sf::Color::Black;
-            constraint_line[1].color = sf::Color::Black;
-            target.draw(constraint_line, 2, sf::Lines);
+    void render(const FrameView &frame) {
+        buildParticles(frame);
+        buildLines(frame);
+        buildPolygons(frame);
+        target.draw(particles, sf::RenderStates(&circle_texture));
+        target.draw(lines);
+        target.draw(polygons);
+    }
+private:
+    sf::RenderTarget &target;
+    FrameSnapshot snapshot;
+    sf::Texture circle_texture;
+    sf::Vector2f texture_size;
+    sf::VertexArray particles{sf::Quads};
+    sf::VertexArray lines{sf::Lines};
+    sf::VertexArray polygons{sf::Triangles};
+
+    void loadCircleTexture() {
+        bool loaded = false;
+        for (const char *path : CIRCLE_TEXTURE_PATHS) {
+            if (circle_texture.loadFromFile(path)) {
+                loaded = true;
+                break;
+            }
         }
+        if (!loaded) {
+            std::cerr << "Could not find res/circle.png, using a generated circle texture" << std::endl;
+            circle_texture.loadFromImage(generateCircleImage(FALLBACK_TEXTURE_SIZE));
+        }
+        circle_texture.setSmooth(true);
+        circle_texture.generateMipmap();
+        texture_size = {static_cast<float>(circle_texture.getSize().x),
+                        static_cast<float>(circle_texture.getSize().y)};
+    }
 
-        const auto &soft_bodies = solver.soft_bodies;
-        for (const auto &soft_body : soft_bodies) {
-            sf::Vertex polygon[soft_body.points];
-            for (int32_t i=0; i<soft_body.points; i++) {
-                polygon[i].position = soft_body.vertices[i]->curr_position;
-                polygon[i].color = soft_body.vertices[i]->colour;
+    static sf::Image generateCircleImage(uint32_t size) {
+        sf::Image image;
+        image.create(size, size, sf::Color::Transparent);
+        const float radius = 0.5f * size;
+        for (uint32_t y=0; y<size; y++) {
+            for (uint32_t x=0; x<size; x++) {
+                const float dx = x + 0.5f - radius;
+                const float dy = y + 0.5f - radius;
+                const float coverage = std::min(std::max(radius - std::sqrt(dx * dx + dy * dy), 0.0f), 1.0f);
+                image.setPixel(x, y, sf::Color(255, 255, 255, static_cast<uint8_t>(255.0f * coverage)));
             }
-            target.draw(polygon, soft_body.points, sf::TriangleFan);
         }
+        return image;
+    }
+
+    void buildParticles(const FrameView &frame) {
+        particles.resize(4 * frame.object_count);
+        uint32_t vertex = 0;
+        for (uint32_t idx=0; idx<frame.object_count; idx++) {
+            const FrameObject &object = frame.objects[idx];
+            if (!object.radius) continue;
+            const sf::Vector2f position = frame.getPosition(idx);
+            const float radius = object.radius;
+            particles[vertex + 0] = {{position.x - radius, position.y - radius}, object.colour, {0.0f, 0.0f}};
+            particles[vertex + 1] = {{position.x + radius, position.y - radius}, object.colour, {texture_size.x, 0.0f}};
+            particles[vertex + 2] = {{position.x + radius, position.y + radius}, object.colour, texture_size};
+            particles[vertex + 3] = {{position.x - radius, position.y + radius}, object.colour, {0.0f, texture_size.y}};
+            vertex += 4;
+        }
+        particles.resize(vertex);
+    }
 
-        const auto &rigid_bodies = solver.rigid_bodies;
-        for (const auto &rigid_body : rigid_bodies) {
-            sf::Vertex polygon[rigid_body.points];
-            for (int32_t i=0; i<rigid_body.points; i++) {
-                polygon[i].position = rigid_body.vertices[i]->curr_position;
-                polygon[i].color = rigid_body.vertices[i]->colour;
+    void buildLines(const FrameView &frame) {
+        const uint32_t constraint_vertices = 2 * frame.line_count;
+        lines.resize(constraint_vertices + 2 * frame.static_line_count);
+        for (uint32_t idx=0; idx<constraint_vertices; idx++) {
+            lines[idx] = {frame.getPosition(frame.lines[idx]), sf::Color::Black};
+        }
+        for (uint32_t idx=0; idx<2 * frame.static_line_count; idx++) {
+            lines[constraint_vertices + idx] = {frame.static_lines[idx], sf::Color::Black};
+        }
+    }
+
+    // Each body is a triangle fan around its first vertex, split into
+    // independent triangles so that all bodies share one batch.
+    void buildPolygons(const FrameView &frame) {
+        uint32_t triangle_count = 0;
+        for (uint32_t idx=0; idx<frame.polygon_count; idx++) {
+            const uint32_t points = frame.polygon_offsets[idx + 1] - frame.polygon_offsets[idx];
+            triangle_count += points > 2 ? points - 2 : 0;
+        }
+        polygons.resize(3 * triangle_count);
+        uint32_t vertex = 0;
+        for (uint32_t idx=0; idx<frame.polygon_count; idx++) {
+            const uint32_t start = frame.polygon_offsets[idx];
+            const uint32_t end = frame.polygon_offsets[idx + 1];
+            if (end - start < 3) continue;
+            const uint32_t pivot = frame.polygon_indices[start];
+            for (uint32_t i=start + 1; i + 1<end; i++) {
+                const uint32_t current = frame.polygon_indices[i];
+                const uint32_t next = frame.polygon_indices[i + 1];
+                polygons[vertex++] = {frame.getPosition(pivot), frame.objects[pivot].colour};
+                polygons[vertex++] = {frame.getPosition(current), frame.objects[current].colour};
+                polygons[vertex++] = {frame.getPosition(next), frame.objects[next].colour};
             }
-            target.draw(polygon, rigid_body.points, sf::TriangleFan);
         }
     }
-private:
-    sf::RenderTarget &target;
 };
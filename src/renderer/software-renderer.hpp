@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/solver.hpp"
+#include "../thread_pool/thread_pool.hpp"
+#include "frame.hpp"
+
+constexpr uint32_t RASTER_TILE_SIZE = 32;
+constexpr float RASTER_LINE_WIDTH = 1.0f;
+
+// Draws the same particles, lines and body fans as Renderer, but
+// into a CPU-side RGBA buffer, so frames can be exported without a window
+// or a GPU. Primitives are binned into fixed-size screen tiles and each
+// tile is rasterised by one pool task, so no two tasks touch the same
+// pixel. Within a tile, primitives are drawn in the same order as Renderer.
+class SoftwareRenderer {
+public:
+    SoftwareRenderer(uint32_t width, uint32_t height, tp::ThreadPool &thread_pool)
+        : width{width}
+        , height{height}
+        , tiles_x{(width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE}
+        , tiles_y{(height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE}
+        , thread_pool{thread_pool}
+        , pixels(4 * width * height)
+        , bins(thread_pool.thread_count, std::vector<std::vector<uint32_t>>(tiles_x * tiles_y))
+    {}
+
+    void render(const Solver &solver) {
+        snapshot.capture(solver);
+        render(snapshot.view());
+    }
+
+    void render(const FrameView &frame) {
+        buildPrimitives(frame);
+        binPrimitives();
+        rasteriseTiles();
+    }
+
+    // Writes the last rendered frame. ".ppm" is written directly, which is
+    // the cheapest option for piping into an encoder; any other extension
+    // is encoded by sf::Image (png, bmp, tga or jpg).
+    bool save(const std::string &path) const {
+        const std::string extension = path.substr(path.find_last_of('.') + 1);
+        if (extension == "ppm") {
+            return savePPM(path);
+        }
+        sf::Image image;
+        image.create(width, height, pixels.data());
+        return image.saveToFile(path);
+    }
+
+    const std::vector<uint8_t> &getPixels() const {
+        return pixels;
+    }
+
+    uint32_t getWidth() const {
+        return width;
+    }
+
+    uint32_t getHeight() const {
+        return height;
+    }
+private:
+    enum class PrimitiveType : uint8_t {
+        None,
+        Circle,
+        Line,
+        Triangle,
+    };
+
+    // Vertices index positions; the pixel bounds are inclusive and already
+    // clipped to the image.
+    struct Primitive {
+        PrimitiveType type = PrimitiveType::None;
+        uint32_t vertices[3] = {0, 0, 0};
+        int32_t min_x = 0, min_y = 0, max_x = -1, max_y = -1;
+    };
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    tp::ThreadPool &thread_pool;
+    std::vector<uint8_t> pixels;
+    FrameSnapshot snapshot;
+    std::vector<sf::Vector2f> positions;
+    std::vector<float> radii;
+    std::vector<sf::Color> colours;
+    std::vector<Primitive> primitives;
+    std::vector<std::vector<std::vector<uint32_t>>> bins;
+
+    // Circles take the first object_count slots and lines the next
+    // line_count, so both can be filled in parallel; static collider
+    // outlines follow, with their endpoints stored after the objects'
+    // positions, and fans are split into triangles serially after them.
+    void buildPrimitives(const FrameView &frame) {
+        const uint32_t line_end = frame.object_count + frame.line_count;
+        positions.resize(frame.object_count + 2 * frame.static_line_count);
+        radii.resize(frame.object_count);
+        colours.resize(frame.object_count);
+        primitives.resize(line_end + frame.static_line_count);
+        thread_pool.dispatch(frame.object_count, [&](uint32_t start, uint32_t end) {
+            for (uint32_t idx=start; idx<end; idx++) {
+                positions[idx] = frame.getPosition(idx);
+                radii[idx] = frame.objects[idx].radius;
+                colours[idx] = frame.objects[idx].colour;
+                primitives[idx] = radii[idx] ? makeCircle(idx) : Primitive{};
+            }
+        });
+        thread_pool.dispatch(frame.line_count, [&](uint32_t start, uint32_t end) {
+            for (uint32_t idx=start; idx<end; idx++) {
+                primitives[frame.object_count + idx] = makePrimitive(
+                    PrimitiveType::Line, {frame.lines[2 * idx], frame.lines[2 * idx + 1], 0}, 2, RASTER_LINE_WIDTH);
+            }
+        });
+        for (uint32_t idx=0; idx<frame.static_line_count; idx++) {
+            const uint32_t start = frame.object_count + 2 * idx;
+            positions[start] = frame.static_lines[2 * idx];
+            positions[start + 1] = frame.static_lines[2 * idx + 1];
+            primitives[line_end + idx] = makePrimitive(PrimitiveType::Line, {start, start + 1, 0}, 2, RASTER_LINE_WIDTH);
+        }
+        for (uint32_t idx=0; idx<frame.polygon_count; idx++) {
+            const uint32_t start = frame.polygon_offsets[idx];
+            const uint32_t end = frame.polygon_offsets[idx + 1];
+            if (end - start < 3) continue;
+            const uint32_t pivot = frame.polygon_indices[start];
+            for (uint32_t i=start + 1; i + 1<end; i++) {
+                primitives.push_back(makePrimitive(
+                    PrimitiveType::Triangle, {pivot, frame.polygon_indices[i], frame.polygon_indices[i + 1]}, 3, 0.0f));
+            }
+        }
+    }
+
+    Primitive makeCircle(uint32_t idx) const {
+        const sf::Vector2f position = positions[idx];
+        const float radius = radii[idx] + 0.5f;
+        Primitive primitive{PrimitiveType::Circle, {idx, 0, 0}};
+        clipBounds(primitive, position.x - radius, position.y - radius, position.x + radius, position.y + radius);
+        return primitive;
+    }
+
+    Primitive makePrimitive(PrimitiveType type, std::array<uint32_t, 3> vertices, uint32_t vertex_count, float margin) const {
+        Primitive primitive{type, {vertices[0], vertices[1], vertices[2]}};
+        sf::Vector2f min = positions[vertices[0]];
+        sf::Vector2f max = min;
+        for (uint32_t i=1; i<vertex_count; i++) {
+            const sf::Vector2f position = positions[vertices[i]];
+            min = {std::min(min.x, position.x), std::min(min.y, position.y)};
+            max = {std::max(max.x, position.x), std::max(max.y, position.y)};
+        }
+        clipBounds(primitive, min.x - margin, min.y - margin, max.x + margin, max.y + margin);
+        return primitive;
+    }
+
+    void clipBounds(Primitive &primitive, float min_x, float min_y, float max_x, float max_y) const {
+        primitive.min_x = std::max(static_cast<int32_t>(std::floor(min_x)), 0);
+        primitive.min_y = std::max(static_cast<int32_t>(std::floor(min_y)), 0);
+        primitive.max_x = std::min(static_cast<int32_t>(std::ceil(max_x)), static_cast<int32_t>(width) - 1);
+        primitive.max_y = std::min(static_cast<int32_t>(std::ceil(max_y)), static_cast<int32_t>(height) - 1);
+        if (primitive.min_x > primitive.max_x || primitive.min_y > primitive.max_y) {
+            primitive.type = PrimitiveType::None;
+        }
+    }
+
+    // Each task bins one contiguous run of primitives into its own set of
+    // tile lists, so binning needs no locks and the lists of a tile, read in
+    // task order, are still in draw order.
+    void binPrimitives() {
+        const uint32_t batch_count = bins.size();
+        const uint32_t batch_size = (primitives.size() + batch_count - 1) / batch_count;
+        for (uint32_t batch=0; batch<batch_count; batch++) {
+            thread_pool.enqueueTask([this, batch, batch_size]() {
+                for (auto &tile : bins[batch]) {
+                    tile.clear();
+                }
+                const uint32_t start = std::min<uint32_t>(batch * batch_size, primitives.size());
+                const uint32_t end = std::min<uint32_t>(start + batch_size, primitives.size());
+                for (uint32_t idx=start; idx<end; idx++) {
+                    const Primitive &primitive = primitives[idx];
+                    if (primitive.type == PrimitiveType::None) continue;
+                    for (int32_t y=primitive.min_y / RASTER_TILE_SIZE; y<=primitive.max_y / RASTER_TILE_SIZE; y++) {
+                        for (int32_t x=primitive.min_x / RASTER_TILE_SIZE; x<=primitive.max_x / RASTER_TILE_SIZE; x++) {
+                            bins[batch][y * tiles_x + x].push_back(idx);
+                        }
+                    }
+                }
+            });
+        }
+        thread_pool.completeAllTasks();
+    }
+
+    // Tiles are handed out from a shared counter rather than in fixed ranges,
+    // since a tile covering a pile costs far more than an empty one.
+    void rasteriseTiles() {
+        std::atomic<uint32_t> next_tile{0};
+        for (uint32_t i=0; i<thread_pool.thread_count; i++) {
+            thread_pool.enqueueTask([this, &next_tile]() {
+                for (uint32_t tile = next_tile++; tile < tiles_x * tiles_y; tile = next_tile++) {
+                    rasteriseTile(tile);
+                }
+            });
+        }
+        thread_pool.completeAllTasks();
+    }
+
+    void rasteriseTile(uint32_t tile) {
+        const int32_t tile_min_x = (tile % tiles_x) * RASTER_TILE_SIZE;
+        const int32_t tile_min_y = (tile / tiles_x) * RASTER_TILE_SIZE;
+        const int32_t tile_max_x = std::min<int32_t>(tile_min_x + RASTER_TILE_SIZE, width) - 1;
+        const int32_t tile_max_y = std::min<int32_t>(tile_min_y + RASTER_TILE_SIZE, height) - 1;
+        for (int32_t y=tile_min_y; y<=tile_max_y; y++) {
+            std::fill(pixels.begin() + 4 * (y * width + tile_min_x), pixels.begin() + 4 * (y * width + tile_max_x + 1), 255);
+        }
+        for (const auto &batch : bins) {
+            for (const uint32_t idx : batch[tile]) {
+                Primitive clipped = primitives[idx];
+                clipped.min_x = std::max(clipped.min_x, tile_min_x);
+                clipped.min_y = std::max(clipped.min_y, tile_min_y);
+                clipped.max_x = std::min(clipped.max_x, tile_max_x);
+                clipped.max_y = std::min(clipped.max_y, tile_max_y);
+                switch (clipped.type) {
+                    case PrimitiveType::Circle: drawCircle(clipped); break;
+                    case PrimitiveType::Line: drawLine(clipped); break;
+                    case PrimitiveType::Triangle: drawTriangle(clipped); break;
+                    case PrimitiveType::None: break;
+                }
+            }
+        }
+    }
+
+    // Coverage falls off over one pixel at the rim, matching the edge of the
+    // circle texture used by Renderer.
+    void drawCircle(const Primitive &primitive) {
+        const sf::Vector2f centre = positions[primitive.vertices[0]];
+        const float radius = radii[primitive.vertices[0]];
+        const sf::Color colour = colours[primitive.vertices[0]];
+        const float inner = std::max(radius - 0.5f, 0.0f);
+        const float outer = radius + 0.5f;
+        for (int32_t y=primitive.min_y; y<=primitive.max_y; y++) {
+            const float dy = y + 0.5f - centre.y;
+            for (int32_t x=primitive.min_x; x<=primitive.max_x; x++) {
+                const float dx = x + 0.5f - centre.x;
+                const float distance_squared = dx * dx + dy * dy;
+                if (distance_squared >= outer * outer) continue;
+                const float coverage = distance_squared <= inner * inner
+                    ? 1.0f
+                    : outer - std::sqrt(distance_squared);
+                blend(x, y, colour, coverage);
+            }
+        }
+    }
+
+    void drawLine(const Primitive &primitive) {
+        const sf::Vector2f start = positions[primitive.vertices[0]];
+        const sf::Vector2f direction = positions[primitive.vertices[1]] - start;
+        const float length_squared = direction.x * direction.x + direction.y * direction.y;
+        for (int32_t y=primitive.min_y; y<=primitive.max_y; y++) {
+            for (int32_t x=primitive.min_x; x<=primitive.max_x; x++) {
+                const sf::Vector2f offset = sf::Vector2f(x + 0.5f, y + 0.5f) - start;
+                const float t = length_squared
+                    ? std::min(std::max((offset.x * direction.x + offset.y * direction.y) / length_squared, 0.0f), 1.0f)
+                    : 0.0f;
+                const sf::Vector2f closest = offset - t * direction;
+                const float distance = std::sqrt(closest.x * closest.x + closest.y * closest.y);
+                blend(x, y, sf::Color::Black, RASTER_LINE_WIDTH - distance);
+            }
+        }
+    }
+
+    // Pixel centres are tested against the three edge functions and vertex
+    // colours are interpolated barycentrically, as a GPU would.
+    void drawTriangle(const Primitive &primitive) {
+        const sf::Vector2f a = positions[primitive.vertices[0]];
+        const sf::Vector2f b = positions[primitive.vertices[1]];
+        const sf::Vector2f c = positions[primitive.vertices[2]];
+        const float area = edge(a, b, c);
+        if (!area) return;
+        const sf::Color colour_a = colours[primitive.vertices[0]];
+        const sf::Color colour_b = colours[primitive.vertices[1]];
+        const sf::Color colour_c = colours[primitive.vertices[2]];
+        for (int32_t y=primitive.min_y; y<=primitive.max_y; y++) {
+            for (int32_t x=primitive.min_x; x<=primitive.max_x; x++) {
+                const sf::Vector2f point{x + 0.5f, y + 0.5f};
+                const float w_a = edge(b, c, point) / area;
+                const float w_b = edge(c, a, point) / area;
+                const float w_c = edge(a, b, point) / area;
+                if (w_a < 0.0f || w_b < 0.0f || w_c < 0.0f) continue;
+                const sf::Color colour(
+                    static_cast<uint8_t>(w_a * colour_a.r + w_b * colour_b.r + w_c * colour_c.r),
+                    static_cast<uint8_t>(w_a * colour_a.g + w_b * colour_b.g + w_c * colour_c.g),
+                    static_cast<uint8_t>(w_a * colour_a.b + w_b * colour_b.b + w_c * colour_c.b),
+                    static_cast<uint8_t>(w_a * colour_a.a + w_b * colour_b.a + w_c * colour_c.a));
+                blend(x, y, colour, 1.0f);
+            }
+        }
+    }
+
+    static float edge(sf::Vector2f from, sf::Vector2f to, sf::Vector2f point) {
+        return (to.x - from.x) * (point.y - from.y) - (to.y - from.y) * (point.x - from.x);
+    }
+
+    void blend(int32_t x, int32_t y, sf::Color colour, float coverage) {
+        const float alpha = std::min(std::max(coverage, 0.0f), 1.0f) * colour.a / 255.0f;
+        if (alpha <= 0.0f) return;
+        uint8_t *pixel = &pixels[4 * (y * width + x)];
+        pixel[0] = static_cast<uint8_t>(pixel[0] + alpha * (colour.r - pixel[0]));
+        pixel[1] = static_cast<uint8_t>(pixel[1] + alpha * (colour.g - pixel[1]));
+        pixel[2] = static_cast<uint8_t>(pixel[2] + alpha * (colour.b - pixel[2]));
+        pixel[3] = 255;
+    }
+
+    bool savePPM(const std::string &path) const {
+        std::ofstream file{path, std::ios::binary | std::ios::trunc};
+        if (!file) return false;
+        file << "P6\n" << width << " " << height << "\n255\n";
+        std::vector<uint8_t> row(3 * width);
+        for (uint32_t y=0; y<height; y++) {
+            for (uint32_t x=0; x<width; x++) {
+                const uint8_t *pixel = &pixels[4 * (y * width + x)];
+                row[3 * x + 0] = pixel[0];
+                row[3 * x + 1] = pixel[1];
+                row[3 * x + 2] = pixel[2];
+            }
+            file.write(reinterpret_cast<const char *>(row.data()), row.size());
+        }
+        return file.good();
+    }
+};
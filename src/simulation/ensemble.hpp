@@ -0,0 +1,134 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/solver.hpp"
+#include "../thread_pool/thread_pool.hpp"
+
+struct EnsembleStats {
+  uint64_t scene_frames = 0;
+  uint64_t particle_substeps = 0;
+  double seconds = 0.0;
+
+  double getSceneFramesPerSecond() const {
+    return seconds > 0.0 ? scene_frames / seconds : 0.0;
+  }
+
+  double getParticleSubstepsPerSecond() const {
+    return seconds > 0.0 ? particle_substeps / seconds : 0.0;
+  }
+};
+
+// Many small, independent scenes stepped side by side. Each scene is a
+// Solver of its own, stepped single-threaded with updateCellular, and whole
+// scenes are shared out across the pool instead of splitting any one scene:
+// scene i always belongs to worker i % thread_count, which creates it (so its
+// memory is allocated, and first touched, by that worker) and steps it.
+// A run is one task per worker with a single wait at the end.
+struct Ensemble {
+  Ensemble(tp::ThreadPool &thread_pool, sf::Vector2f scene_size,
+           float cell_size, int32_t max_object_count, int32_t framerate,
+           bool gravity_on)
+      : thread_pool{thread_pool}, scene_size{scene_size},
+        cell_size{cell_size}, max_object_count{max_object_count},
+        framerate{framerate}, gravity_on{gravity_on},
+        worker_stats(thread_pool.thread_count) {}
+
+  // Adds scene_count scenes, calling setup(solver, index) for each on the
+  // worker that will step it. setup must not use the thread pool, so it
+  // cannot call updateThreaded.
+  template <typename SetupCallback>
+  void create(uint32_t scene_count, SetupCallback &&setup) {
+    const uint32_t first = solvers.size();
+    solvers.resize(first + scene_count);
+    forEachWorker([&](uint32_t worker) {
+      const uint32_t thread_count = thread_pool.thread_count;
+      const uint32_t offset =
+          (worker + thread_count - first % thread_count) % thread_count;
+      for (uint32_t idx = first + offset; idx < solvers.size();
+           idx += thread_count) {
+        solvers[idx] = std::make_unique<Solver>(
+            scene_size, DEFAULT_SUBSTEPS, cell_size, max_object_count, framerate,
+            false, thread_pool, gravity_on);
+        setup(*solvers[idx], idx);
+      }
+    });
+  }
+
+  // Steps every scene by frame_count frames, each scene all the way through
+  // before the worker moves on to its next one.
+  void run(uint32_t frame_count) {
+    const auto start = std::chrono::steady_clock::now();
+    forEachWorker([&](uint32_t worker) {
+      WorkerStats &stats = worker_stats[worker];
+      for (uint32_t idx = worker; idx < solvers.size();
+           idx += thread_pool.thread_count) {
+        Solver &solver = *solvers[idx];
+        for (uint32_t frame = 0; frame < frame_count; frame++) {
+          solver.updateCellular();
+        }
+        stats.scene_frames += frame_count;
+        stats.particle_substeps += static_cast<uint64_t>(frame_count) *
+                                   solver.getSubsteps() *
+                                   solver.objects.size();
+      }
+    });
+    total_seconds += std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  }
+
+  // Totals over every run since construction or the last resetStats.
+  EnsembleStats getStats() const {
+    EnsembleStats stats;
+    for (const WorkerStats &worker : worker_stats) {
+      stats.scene_frames += worker.scene_frames;
+      stats.particle_substeps += worker.particle_substeps;
+    }
+    stats.seconds = total_seconds;
+    return stats;
+  }
+
+  void resetStats() {
+    for (WorkerStats &worker : worker_stats) {
+      worker = WorkerStats{};
+    }
+    total_seconds = 0.0;
+  }
+
+  uint32_t getSceneCount() const { return solvers.size(); }
+
+  Solver &operator[](uint32_t idx) { return *solvers[idx]; }
+
+  const Solver &operator[](uint32_t idx) const { return *solvers[idx]; }
+
+private:
+  struct alignas(64) WorkerStats {
+    uint64_t scene_frames = 0;
+    uint64_t particle_substeps = 0;
+  };
+
+  tp::ThreadPool &thread_pool;
+  sf::Vector2f scene_size;
+  float cell_size;
+  int32_t max_object_count;
+  int32_t framerate;
+  bool gravity_on;
+  std::vector<std::unique_ptr<Solver>> solvers;
+  std::vector<WorkerStats> worker_stats;
+  double total_seconds = 0.0;
+
+  template <typename WorkerCallback>
+  void forEachWorker(WorkerCallback &&callback) {
+    for (uint32_t worker = 0; worker < thread_pool.thread_count; worker++) {
+      thread_pool.enqueueTaskFor(worker,
+                                 [&callback, worker] { callback(worker); });
+    }
+    thread_pool.completeAllTasks();
+  }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+constexpr int32_t MAX_STEPS_PER_FRAME = 5;
+
+// Accumulates wall time and converts it into a whole number of fixed steps.
+// At most max_steps are taken per call; any backlog beyond that is dropped,
+// so a machine that cannot keep up slows the simulation down instead of
+// falling further and further behind.
+struct FixedTimestep {
+  explicit FixedTimestep(float step_dt,
+                         int32_t max_steps = MAX_STEPS_PER_FRAME)
+      : step_dt{step_dt}, max_steps{max_steps} {}
+
+  int32_t advance(float elapsed) {
+    accumulator += elapsed;
+    int32_t steps = static_cast<int32_t>(accumulator / step_dt);
+    if (steps > max_steps) {
+      steps = max_steps;
+      accumulator = static_cast<float>(steps) * step_dt;
+    }
+    accumulator -= static_cast<float>(steps) * step_dt;
+    return steps;
+  }
+
+  float getTimeToNextStep() const { return step_dt - accumulator; }
+
+  float getStepDt() const { return step_dt; }
+
+private:
+  float step_dt;
+  int32_t max_steps;
+  float accumulator = 0.0f;
+};
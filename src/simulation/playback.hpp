@@ -0,0 +1,138 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+#include "../recording/trajectory.hpp"
+#include "../renderer/renderer.hpp"
+
+constexpr float PLAYBACK_SEEK_SECONDS = 1.0f;
+constexpr float PLAYBACK_MIN_SPEED = 0.125f;
+constexpr float PLAYBACK_MAX_SPEED = 256.0f;
+
+struct Playback {
+  Playback(const std::vector<std::string> &paths, std::string name) {
+    for (const auto &path : paths) {
+      auto &recording =
+          recordings.emplace_back(std::make_unique<TrajectoryReader>(path));
+      if (!recording->isOpen()) {
+        std::cerr << "Could not open recording " << path << std::endl;
+        recordings.pop_back();
+      }
+    }
+    if (recordings.empty())
+      return;
+    const sf::Vector2f size = recordings.front()->size();
+    window.create(sf::VideoMode(size.x, size.y), name, sf::Style::Default,
+                  settings);
+    renderer = std::make_unique<Renderer>(window);
+  }
+
+public:
+  void run() {
+    if (!renderer)
+      return;
+    clock.restart();
+    while (window.isOpen()) {
+      handleWindowEvents();
+      const float elapsed = clock.restart().asSeconds();
+      if (!paused) {
+        seek(elapsed * speed);
+      }
+      handleRender();
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<TrajectoryReader>> recordings;
+  sf::ContextSettings settings;
+  sf::RenderWindow window;
+  std::unique_ptr<Renderer> renderer;
+  sf::Clock clock;
+  float playback_time = 0.0f;
+  float speed = 1.0f;
+  bool paused = false;
+
+  float getDuration() const {
+    float duration = 0.0f;
+    for (const auto &recording : recordings) {
+      duration = std::max(duration, recording->frameCount() *
+                                        recording->frameDt());
+    }
+    return duration;
+  }
+
+  void seek(float offset) {
+    playback_time =
+        std::min(std::max(playback_time + offset, 0.0f), getDuration());
+  }
+
+  void handleWindowEvents() {
+    sf::Event event;
+    while (window.pollEvent(event)) {
+      if (event.type == sf::Event::Closed ||
+          sf::Keyboard::isKeyPressed(sf::Keyboard::Escape)) {
+        window.close();
+      } else if (event.type == sf::Event::KeyPressed) {
+        switch (event.key.code) {
+        case sf::Keyboard::Space:
+          paused = !paused;
+          break;
+        case sf::Keyboard::Right:
+          seek(PLAYBACK_SEEK_SECONDS * speed);
+          break;
+        case sf::Keyboard::Left:
+          seek(-PLAYBACK_SEEK_SECONDS * speed);
+          break;
+        case sf::Keyboard::Up:
+          speed = std::min(2.0f * speed, PLAYBACK_MAX_SPEED);
+          break;
+        case sf::Keyboard::Down:
+          speed = std::max(0.5f * speed, PLAYBACK_MIN_SPEED);
+          break;
+        case sf::Keyboard::Home:
+          playback_time = 0.0f;
+          break;
+        default:
+          break;
+        }
+      }
+    }
+  }
+
+  // Recordings are laid out side by side, each letterboxed into an equal
+  // share of the window, and all of them are shown at the same sim time.
+  sf::View getPanelView(const TrajectoryReader &recording, int32_t panel) {
+    const float panel_count = recordings.size();
+    const sf::Vector2f window_size{static_cast<float>(window.getSize().x),
+                                   static_cast<float>(window.getSize().y)};
+    const sf::Vector2f world = recording.size();
+    const float panel_aspect = window_size.x / panel_count / window_size.y;
+    sf::Vector2f view_size = world;
+    if (world.x / world.y > panel_aspect) {
+      view_size.y = world.x / panel_aspect;
+    } else {
+      view_size.x = world.y * panel_aspect;
+    }
+    sf::View view;
+    view.setCenter(0.5f * world);
+    view.setSize(view_size);
+    view.setViewport({panel / panel_count, 0.0f, 1.0f / panel_count, 1.0f});
+    return view;
+  }
+
+  void handleRender() {
+    window.clear(sf::Color::White);
+    for (int32_t panel = 0; panel < recordings.size(); panel++) {
+      const TrajectoryReader &recording = *recordings[panel];
+      window.setView(getPanelView(recording, panel));
+      renderer->render(recording.frame(recording.frameAt(playback_time)));
+    }
+    window.setView(window.getDefaultView());
+    window.display();
+  }
+};
@@ -1,14 +1,40 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
 #include <SFML/Graphics.hpp>
 
+#include "../network/server.hpp"
 #include "../physics/solver.hpp"
+#include "../recording/trajectory.hpp"
 #include "../renderer/renderer.hpp"
+#include "../renderer/software-renderer.hpp"
 #include "../thread_pool/thread_pool.hpp"
+#include "../utils/command-queue.hpp"
 #include "../utils/maths.hpp"
+#include "../utils/triple-buffer.hpp"
+#include "fixed-timestep.hpp"
 
 constexpr float ROPE_SEGMENT_LENGTH = 10.0f;
 constexpr float DUMMY_RADIUS = 8.0f;
+constexpr uint32_t COMMAND_QUEUE_CAPACITY = 256;
+
+struct PublishedFrame {
+  FrameSnapshot snapshot;
+  std::chrono::steady_clock::time_point published_at;
+};
+
+struct SimulationCommand {
+  enum Type : uint8_t { Attractor, Repeller, SpeedUp, SlowDown, Slomo };
+  Type type;
+  bool active;
+};
 
 struct Simulation {
   Simulation(bool render_display, int32_t window_width, int32_t window_height,
@@ -20,10 +46,7 @@ struct Simulation {
         window_width{window_width}, min_radius{min_radius},
         max_radius{max_radius}, collision_resolver{collision_resolver},
         thread_pool{tp::ThreadPool(thread_count)},
-        settings{settings.antialiasingLevel = 4},
-        window{sf::VideoMode(window_width, window_height), name,
-               sf::Style::Default, settings},
-        solver{sf::Vector2f(window_width, window_height),
+        settings{settings.antialiasingLevel = 4}, solver{sf::Vector2f(window_width, window_height),
                substeps,
                collision_resolver == 2 &&
                        window_width / 2.0f / max_radius / thread_count < 2
@@ -33,8 +56,13 @@ struct Simulation {
                framerate_limit,
                speed_colouring,
                thread_pool,
-               gravity_on},
-        renderer{window} {}
+               gravity_on} {
+    if (render_display) {
+      window.create(sf::VideoMode(window_width, window_height), name,
+                    sf::Style::Default, settings);
+      renderer = std::make_unique<Renderer>(window);
+    }
+  }
 
 public:
   void spawnRigidBody(std::pair<float, float> spawn_position, int side_count,
@@ -42,7 +70,6 @@ public:
     solver.body_count++;
     const float radius = side_length / (2 * sin(M_PI / side_count));
     const int32_t side_points = side_length / DUMMY_RADIUS;
-    const float segment_length = side_length / side_points;
     const sf::Vector2f centre{(1.0f - spawn_position.first) * window_width,
                               (1.0f - spawn_position.second) * window_height};
     const float angle_step = 2 * M_PI / side_count;
@@ -71,42 +98,7 @@ public:
       }
     }
 
-    std::vector<VerletConstraint *> segments;
-    const int32_t points = vertices.size();
-    for (int32_t i = 0; i < points; i++) {
-      VerletObject *current = vertices[i];
-      VerletObject *next = vertices[(i + 1) % points];
-      VerletConstraint &segment =
-          solver.addConstraint(*current, *next, segment_length);
-      segments.push_back(&segment);
-      segment.in_body = true;
-    }
-
-    for (int32_t i = 0; i < points; i += side_points) {
-      VerletObject *current = vertices[i];
-      VerletObject *next = vertices[(i + side_points) % points];
-      VerletConstraint &segment =
-          solver.addConstraint(*current, *next, side_length);
-      segments.push_back(&segment);
-      segment.in_body = true;
-    }
-
-    // for (int32_t i=0; i<points; i++) {
-    //     for (int32_t j=i+2; j<points; j++) {
-    //         if (j != (i + points - 1) % points) {
-    //             float diagonal_length = sqrt(pow(vertices[i]->curr_position.x
-    //             - vertices[j]->curr_position.x, 2) +
-    //                 pow(vertices[i]->curr_position.y -
-    //                 vertices[j]->curr_position.y, 2));
-    //             VerletConstraint &segment =
-    //             solver.addConstraint(*vertices[i], *vertices[j],
-    //             diagonal_length); segments.push_back(&segment);
-    //             segment.in_body = true;
-    //         }
-    //     }
-    // }
-
-    solver.addRigidBody(vertices, segments, side_length);
+    solver.addRigidBody(vertices);
     update();
     handleRender();
   }
@@ -154,31 +146,7 @@ public:
       object.colour = getRainbowColour();
       vertices.push_back(&object);
     }
-    std::vector<VerletConstraint *> segments;
-    const int32_t points = vertices.size();
-    for (int32_t i = 0; i < points; i++) {
-      VerletObject *current = vertices[i];
-      VerletObject *next = vertices[(i + 1) % points];
-      VerletConstraint &segment =
-          solver.addConstraint(*current, *next, segment_length);
-      segments.push_back(&segment);
-      segment.in_body = true;
-    }
-    side_points = points / 4;
-    for (int32_t i = 0; i < points; i += side_points) {
-      VerletObject *current = vertices[i];
-      VerletObject *diagonal1 = vertices[(i + side_points) % points];
-      VerletObject *diagonal2 = vertices[(i + 2 * side_points) % points];
-      VerletConstraint &segment1 =
-          solver.addConstraint(*current, *diagonal1, side_length);
-      VerletConstraint &segment2 =
-          solver.addConstraint(*current, *diagonal2, sqrt(2) * side_length);
-      segments.push_back(&segment1);
-      segments.push_back(&segment2);
-      segment1.in_body = true;
-      segment2.in_body = true;
-    }
-    solver.addRigidBody(vertices, segments, side_length);
+    solver.addRigidBody(vertices);
     update();
     handleRender();
   }
@@ -227,17 +195,15 @@ public:
         (1.0f - spawn_position.first) * window_width,
         (1.0f - spawn_position.second) * window_height};
     VerletObject *last_object = nullptr;
-    while (window.isOpen() && total <= length) {
-      handleWindowEvents();
-      if (clock.getElapsedTime().asSeconds() >= spawn_delay) {
-        clock.restart();
+    runPipelined([&] {
+      if (isSpawnDue(spawn_delay)) {
         spawnRopeObject(total, last_object, radius, fixed_position,
                         total == length);
         total++;
       }
       update();
-      handleRender();
-    }
+      return total <= length;
+    });
   }
 
   void spawnFree(int32_t count, std::pair<float, float> spawn_position,
@@ -247,27 +213,117 @@ public:
         (1.0f - spawn_position.first) * window_width,
         (1.0f - spawn_position.second) * window_height};
     const sf::Vector2f spawn_angle_vector{cos(spawn_angle), sin(spawn_angle)};
-    while (window.isOpen() && total < count) {
-      handleWindowEvents();
-      if (clock.getElapsedTime().asSeconds() >= spawn_delay) {
-        clock.restart();
+    runPipelined([&] {
+      if (isSpawnDue(spawn_delay)) {
         spawnFreeObject(spawn_position_vector, spawn_angle_vector,
                         rng.getRange(min_radius, max_radius), spawn_speed);
         total++;
       }
       update();
-      handleRender();
+      return total < count;
+    });
+  }
+
+  // Seeds the radius RNG and switches the solver and spawn timers to
+  // thread-count-independent, simulated-time-driven behaviour.
+  void setDeterministic(uint32_t seed) {
+    rng.seed(seed);
+    solver.setDeterministic(true);
+  }
+
+  // Positions and radii are in pixels. Returns an id for removeForceField.
+  uint32_t addForceField(const ForceField &field) {
+    return solver.addForceField(field);
+  }
+
+  void removeForceField(uint32_t id) { solver.removeForceField(id); }
+
+  // Level geometry in pixels. Each returns an id for removeStaticCollider;
+  // addStaticPolygon returns STATIC_SHAPE_INVALID unless the polygon is
+  // convex.
+  uint32_t addStaticSegment(sf::Vector2f a, sf::Vector2f b) {
+    return solver.addStaticSegment(a, b);
+  }
+
+  uint32_t addStaticCapsule(sf::Vector2f a, sf::Vector2f b, float radius) {
+    return solver.addStaticCapsule(a, b, radius);
+  }
+
+  uint32_t addStaticPolygon(const std::vector<sf::Vector2f> &points) {
+    return solver.addStaticPolygon(points);
+  }
+
+  void removeStaticCollider(uint32_t id) { solver.removeStaticCollider(id); }
+
+  // Outside the detail regions, quiet parts of the window step once every
+  // interval substeps. Regions are boxes in pixels; returns an id for
+  // removeDetailRegion.
+  void setCoarseInterval(int32_t interval, float rest_speed) {
+    solver.setCoarseInterval(interval, rest_speed);
+  }
+
+  uint32_t addDetailRegion(sf::Vector2f min, sf::Vector2f max) {
+    return solver.addDetailRegion(min, max);
+  }
+
+  void removeDetailRegion(uint32_t id) { solver.removeDetailRegion(id); }
+
+  // Particles attract (positive strength) or repel (negative) each other.
+  void setLongRangeForce(float strength, float opening_angle) {
+    solver.setLongRangeForce(strength, opening_angle);
+  }
+
+  // Pins pool workers to CPUs spread over the NUMA nodes, and puts each
+  // worker's block of the collision grid on its node.
+  void pinThreads() {
+    const tp::CpuTopology topology = tp::CpuTopology::discover();
+    const uint32_t pinned = thread_pool.pinWorkers(topology);
+    if (pinned < thread_pool.thread_count) {
+      std::cerr << "Pinned " << pinned << " of " << thread_pool.thread_count
+                << " threads" << std::endl;
     }
+    solver.placeGridOnWorkers();
   }
 
-  void idle() {
-    while (window.isOpen()) {
-      handleWindowEvents();
-      update();
-      handleRender();
+  void record(const std::string &path) {
+    recorder = std::make_unique<TrajectoryWriter>(
+        path, sf::Vector2f(window_width, window_height), solver.getFrameDt());
+  }
+
+  // Streams every simulated frame to SimulationClients connecting on a Unix
+  // domain socket path, or a TCP port on localhost, and applies the commands
+  // they send. Headless runs are paced to real time while serving.
+  void serve(const std::string &address) {
+    server = std::make_unique<SimulationServer>(
+        address, sf::Vector2f(window_width, window_height),
+        solver.getFrameDt());
+    if (!server->isOpen()) {
+      std::cerr << "Could not serve on " << address << std::endl;
+      server.reset();
     }
   }
 
+  // Renders every simulated frame with the software rasteriser and writes
+  // it to directory/frame_NNNNNN.extension; the directory must exist.
+  void exportFrames(const std::string &directory,
+                    const std::string &extension) {
+    exporter = std::make_unique<SoftwareRenderer>(window_width, window_height,
+                                                  thread_pool);
+    export_directory = directory;
+    export_extension = extension;
+    exported_frame = 0;
+  }
+
+  // Runs until the window is closed or, if duration is positive, until that
+  // many more seconds have been simulated.
+  void idle(float duration = 0.0f) {
+    const float end_time = solver.time + duration;
+    runPipelined([&] {
+      update();
+      return duration <= 0.0f || solver.time < end_time;
+    });
+  }
+
 private:
   bool render_display;
   int32_t window_width;
@@ -279,9 +335,212 @@ private:
   sf::RenderWindow window;
   tp::ThreadPool thread_pool;
   Solver solver;
-  Renderer renderer;
+  std::unique_ptr<Renderer> renderer;
   sf::Clock clock;
+  float last_spawn_time = 0.0f;
   RNG<float> rng;
+  std::unique_ptr<TrajectoryWriter> recorder;
+  FrameSnapshot recorded_frame;
+  std::unique_ptr<SimulationServer> server;
+  std::unique_ptr<SoftwareRenderer> exporter;
+  std::string export_directory;
+  std::string export_extension;
+  uint32_t exported_frame = 0;
+  TripleBuffer<PublishedFrame> frames;
+  CommandQueue<SimulationCommand, COMMAND_QUEUE_CAPACITY> commands;
+  bool held_controls[SimulationCommand::Slomo + 1] = {};
+  bool sent_controls[SimulationCommand::Slomo + 1] = {};
+
+  // Physics runs step() on its own thread at a fixed rate of one call per
+  // solver frame, publishing a snapshot after each batch of calls, while
+  // this thread handles window events and draws the newest snapshot at the
+  // display rate, interpolated between the last two physics states. Input
+  // reaches the solver only through the command queue. Returns when step()
+  // returns false or the window is closed. Without a display, step() is
+  // simply called back to back on this thread, unless a server is running.
+  template <typename StepCallback> void runPipelined(StepCallback &&step) {
+    if (!render_display && server) {
+      runPaced(step);
+      return;
+    }
+    if (!render_display) {
+      while (step()) {
+      }
+      return;
+    }
+    if (!window.isOpen())
+      return;
+    using Clock = std::chrono::steady_clock;
+    std::atomic<bool> running{true};
+    const float step_dt = solver.getFrameDt();
+    std::thread physics_thread([&] {
+      FixedTimestep timestep{step_dt};
+      Clock::time_point last_time = Clock::now();
+      while (running.load(std::memory_order_relaxed)) {
+        const Clock::time_point now = Clock::now();
+        const int32_t steps = timestep.advance(
+            std::chrono::duration<float>(now - last_time).count());
+        last_time = now;
+        if (!steps) {
+          std::this_thread::sleep_for(
+              std::chrono::duration<float>(timestep.getTimeToNextStep()));
+          continue;
+        }
+        PublishedFrame &published = frames.back();
+        bool more = true;
+        for (int32_t i = 0; i < steps && more; i++) {
+          published.snapshot.capturePrevious(solver);
+          more = step();
+        }
+        published.snapshot.capture(solver);
+        published.published_at = Clock::now();
+        frames.publish();
+        if (!more)
+          break;
+      }
+      running = false;
+    });
+    window.setVerticalSyncEnabled(true);
+    while (running.load(std::memory_order_relaxed)) {
+      handleWindowEvents();
+      if (!window.isOpen())
+        break;
+      frames.acquire();
+      const PublishedFrame &published = frames.front();
+      FrameView frame = published.snapshot.view();
+      const float since_step =
+          std::chrono::duration<float>(Clock::now() - published.published_at)
+              .count();
+      frame.alpha = std::min(std::max(since_step / step_dt, 0.0f), 1.0f);
+      window.clear(sf::Color::White);
+      renderer->render(frame);
+      window.display();
+    }
+    running = false;
+    physics_thread.join();
+  }
+
+  // Calls step() once per solver frame of wall-clock time on this thread.
+  template <typename StepCallback> void runPaced(StepCallback &&step) {
+    using Clock = std::chrono::steady_clock;
+    FixedTimestep timestep{solver.getFrameDt()};
+    Clock::time_point last_time = Clock::now();
+    while (true) {
+      const Clock::time_point now = Clock::now();
+      const int32_t steps = timestep.advance(
+          std::chrono::duration<float>(now - last_time).count());
+      last_time = now;
+      if (!steps) {
+        std::this_thread::sleep_for(
+            std::chrono::duration<float>(timestep.getTimeToNextStep()));
+      }
+      for (int32_t i = 0; i < steps; i++) {
+        if (!step())
+          return;
+      }
+    }
+  }
+
+  void applyCommands() {
+    SimulationCommand command;
+    while (commands.pop(command)) {
+      applyCommand(command);
+    }
+    if (server) {
+      server->poll([this](const StreamCommand &command) {
+        return applyStreamCommand(command);
+      });
+    }
+  }
+
+  void applyCommand(const SimulationCommand &command) {
+    switch (command.type) {
+    case SimulationCommand::Attractor:
+      solver.setAttractor(command.active);
+      break;
+    case SimulationCommand::Repeller:
+      solver.setRepeller(command.active);
+      break;
+    case SimulationCommand::SpeedUp:
+      solver.setSpeedUp(command.active);
+      break;
+    case SimulationCommand::SlowDown:
+      solver.setSlowDown(command.active);
+      break;
+    case SimulationCommand::Slomo:
+      solver.setSlomo(command.active);
+      break;
+    }
+  }
+
+  // Commands come off the network, so anything out of range is refused
+  // rather than trusted.
+  uint32_t applyStreamCommand(const StreamCommand &command) {
+    switch (command.type) {
+    case StreamCommand::Spawn: {
+      const bool inside = command.position.x >= 0.0f &&
+                          command.position.x <= window_width &&
+                          command.position.y >= 0.0f &&
+                          command.position.y <= window_height;
+      // Constraints and bodies point into objects, so it must never grow
+      // past the capacity reserved up front.
+      if (!inside || !std::isfinite(command.velocity.x) ||
+          !std::isfinite(command.velocity.y) || !(command.radius > 0.0f) ||
+          command.radius > 2 * max_radius ||
+          solver.objects.size() >= solver.objects.capacity())
+        return STREAM_COMMAND_FAILED;
+      VerletObject &object =
+          solver.addObject(command.position, command.radius);
+      object.colour = getRainbowColour();
+      solver.setObjectVelocity(object, command.velocity);
+      return solver.objects.size() - 1;
+    }
+    case StreamCommand::AddForceField: {
+      // No field needs to reach further than the window's diagonal.
+      const float max_field_radius =
+          std::sqrt(static_cast<float>(window_width * window_width +
+                                       window_height * window_height));
+      const ForceField &field = command.field;
+      if (field.type > ForceFieldType::Wind ||
+          field.falloff > Falloff::InverseSquare ||
+          !std::isfinite(field.position.x) ||
+          !std::isfinite(field.position.y) ||
+          !std::isfinite(field.direction.x) ||
+          !std::isfinite(field.direction.y) || !std::isfinite(field.strength) ||
+          !(field.radius >= 0.0f) || field.radius > max_field_radius)
+        return STREAM_COMMAND_FAILED;
+      return solver.addForceField(field);
+    }
+    case StreamCommand::RemoveForceField:
+      if (!solver.hasForceField(command.id) ||
+          solver.isBuiltinForceField(command.id))
+        return STREAM_COMMAND_FAILED;
+      solver.removeForceField(command.id);
+      return 0;
+    case StreamCommand::Toggle:
+      if (command.toggle > SimulationCommand::Slomo)
+        return STREAM_COMMAND_FAILED;
+      applyCommand({static_cast<SimulationCommand::Type>(command.toggle),
+                    command.active});
+      return 0;
+    }
+    return STREAM_COMMAND_FAILED;
+  }
+
+  // Headless runs are not paced by the wall clock, so they spawn on
+  // simulated time just like deterministic ones.
+  bool isSpawnDue(float spawn_delay) {
+    if (solver.isDeterministic() || !render_display) {
+      if (solver.time - last_spawn_time < spawn_delay)
+        return false;
+      last_spawn_time = solver.time;
+      return true;
+    }
+    if (clock.getElapsedTime().asSeconds() < spawn_delay)
+      return false;
+    clock.restart();
+    return true;
+  }
 
   sf::Color getRainbowColour() {
     const float time = solver.time;
@@ -319,23 +578,51 @@ private:
     solver.setObjectVelocity(object, speed * angle);
   }
 
+  // Only key presses and releases of the controls are queued, and only when
+  // they change a control, so other events cannot fill the queue. A change
+  // the full queue refuses is retried on the next call instead of lost.
   void handleWindowEvents() {
     sf::Event event;
     while (window.pollEvent(event)) {
       if (event.type == sf::Event::Closed ||
           sf::Keyboard::isKeyPressed(sf::Keyboard::Escape)) {
         window.close();
-      } else {
-        solver.setAttractor(sf::Keyboard::isKeyPressed(sf::Keyboard::A));
-        solver.setRepeller(sf::Keyboard::isKeyPressed(sf::Keyboard::R));
-        solver.setSpeedUp(sf::Keyboard::isKeyPressed(sf::Keyboard::S));
-        solver.setSlowDown(sf::Keyboard::isKeyPressed(sf::Keyboard::W));
-        solver.setSlomo(sf::Keyboard::isKeyPressed(sf::Keyboard::F));
+      } else if (event.type == sf::Event::KeyPressed ||
+                 event.type == sf::Event::KeyReleased) {
+        const int32_t control = getControl(event.key.code);
+        if (control >= 0) {
+          held_controls[control] = event.type == sf::Event::KeyPressed;
+        }
+      }
+    }
+    for (int32_t control = 0; control <= SimulationCommand::Slomo; control++) {
+      if (held_controls[control] != sent_controls[control] &&
+          commands.push({static_cast<SimulationCommand::Type>(control),
+                         held_controls[control]})) {
+        sent_controls[control] = held_controls[control];
       }
     }
   }
 
+  static int32_t getControl(sf::Keyboard::Key key) {
+    switch (key) {
+    case sf::Keyboard::A:
+      return SimulationCommand::Attractor;
+    case sf::Keyboard::R:
+      return SimulationCommand::Repeller;
+    case sf::Keyboard::S:
+      return SimulationCommand::SpeedUp;
+    case sf::Keyboard::W:
+      return SimulationCommand::SlowDown;
+    case sf::Keyboard::F:
+      return SimulationCommand::Slomo;
+    default:
+      return -1;
+    }
+  }
+
   void update() {
+    applyCommands();
     switch (collision_resolver) {
     case 0:
       solver.updateThreaded();
@@ -346,14 +633,41 @@ private:
     case 2:
       solver.updateNaive();
       break;
+    case 3:
+      solver.updateJacobi();
+      break;
     default:
       solver.updateThreaded();
     }
+    if (recorder) {
+      recorded_frame.capture(solver);
+      recorder->write(recorded_frame.view());
+    }
+    if (exporter) {
+      exportFrame();
+    }
+    if (server) {
+      server->publish(solver);
+    }
+  }
+
+  void exportFrame() {
+    exporter->render(solver);
+    std::ostringstream path;
+    path << export_directory << "/frame_" << std::setw(6) << std::setfill('0')
+         << exported_frame++ << "." << export_extension;
+    if (!exporter->save(path.str())) {
+      std::cerr << "Could not write " << path.str()
+                << ", stopping frame export" << std::endl;
+      exporter.reset();
+    }
   }
 
   void handleRender() {
+    if (!renderer || !window.isOpen())
+      return;
     window.clear(sf::Color::White);
-    renderer.render(solver);
+    renderer->render(solver);
     window.display();
   }
 };
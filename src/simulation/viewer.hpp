@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <SFML/Graphics.hpp>
+
+#include "../network/client.hpp"
+#include "../renderer/renderer.hpp"
+#include "simulation.hpp"
+
+constexpr float VIEWER_SPAWN_RADIUS = 10.0f;
+
+// Draws the state a SimulationServer streams, without simulating anything
+// itself. The simulation controls are forwarded to the server as commands,
+// and a left click spawns a particle there.
+struct Viewer {
+  Viewer(const std::string &address, std::string name, float frame_rate,
+         uint32_t bytes_per_second)
+      : client{address, frame_rate, bytes_per_second} {
+    while (client.isOpen() && !client.isReady()) {
+      client.poll();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!client.isReady()) {
+      std::cerr << "Could not connect to " << address << std::endl;
+      return;
+    }
+    const sf::Vector2f size = client.getSize();
+    window.create(sf::VideoMode(size.x, size.y), name, sf::Style::Default,
+                  settings);
+    window.setVerticalSyncEnabled(true);
+    renderer = std::make_unique<Renderer>(window);
+  }
+
+public:
+  void run() {
+    if (!renderer)
+      return;
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point received_at = Clock::now();
+    float frame_interval = client.getFrameDt();
+    while (window.isOpen() && client.isOpen()) {
+      handleWindowEvents();
+      if (client.poll()) {
+        const Clock::time_point now = Clock::now();
+        frame_interval = std::max(
+            std::chrono::duration<float>(now - received_at).count(),
+            client.getFrameDt());
+        received_at = now;
+      }
+      // The viewer has no use for its commands' results, but the client
+      // keeps every one until it is popped.
+      uint32_t result;
+      while (client.popCommandResult(result)) {
+      }
+      window.clear(sf::Color::White);
+      if (client.hasFrame()) {
+        FrameView frame = client.view();
+        const float since_frame =
+            std::chrono::duration<float>(Clock::now() - received_at).count();
+        frame.alpha = std::min(since_frame / frame_interval, 1.0f);
+        renderer->render(frame);
+      }
+      window.display();
+    }
+  }
+
+private:
+  SimulationClient client;
+  sf::ContextSettings settings;
+  sf::RenderWindow window;
+  std::unique_ptr<Renderer> renderer;
+  bool toggles[SimulationCommand::Slomo + 1] = {};
+
+  void handleWindowEvents() {
+    sf::Event event;
+    while (window.pollEvent(event)) {
+      if (event.type == sf::Event::Closed ||
+          sf::Keyboard::isKeyPressed(sf::Keyboard::Escape)) {
+        window.close();
+      } else if (event.type == sf::Event::MouseButtonPressed &&
+                 event.mouseButton.button == sf::Mouse::Left) {
+        StreamCommand command{};
+        command.type = StreamCommand::Spawn;
+        command.position = window.mapPixelToCoords(
+            {event.mouseButton.x, event.mouseButton.y});
+        command.radius = VIEWER_SPAWN_RADIUS;
+        client.sendCommand(command);
+      } else {
+        sendToggle(SimulationCommand::Attractor,
+                   sf::Keyboard::isKeyPressed(sf::Keyboard::A));
+        sendToggle(SimulationCommand::Repeller,
+                   sf::Keyboard::isKeyPressed(sf::Keyboard::R));
+        sendToggle(SimulationCommand::SpeedUp,
+                   sf::Keyboard::isKeyPressed(sf::Keyboard::S));
+        sendToggle(SimulationCommand::SlowDown,
+                   sf::Keyboard::isKeyPressed(sf::Keyboard::W));
+        sendToggle(SimulationCommand::Slomo,
+                   sf::Keyboard::isKeyPressed(sf::Keyboard::F));
+      }
+    }
+  }
+
+  // Only changes are sent, so several viewers do not keep overriding each
+  // other's controls.
+  void sendToggle(SimulationCommand::Type type, bool active) {
+    if (toggles[type] == active)
+      return;
+    toggles[type] = active;
+    StreamCommand command{};
+    command.type = StreamCommand::Toggle;
+    command.toggle = type;
+    command.active = active;
+    client.sendCommand(command);
+  }
+};
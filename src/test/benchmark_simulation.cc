@@ -1,179 +1,496 @@
 #include <benchmark/benchmark.h>
 #include <SFML/Graphics.hpp>
 
-#include "../utils/maths.hpp"
-#include "../simulation/simulation.hpp"
-
-static void BM_updateSimulation(benchmark::State &state) {
-    int32_t window_width = 2000;
-    int32_t window_height = 2000;
-    int32_t max_object_count = state.range(5);
-    float radius = 10.0f;
-    float max_angle = 1.0f;
-    bool speed_colouring = state.range(4);
-    float spawn_delay = 0.005f;
-    float spawn_speed = 10.0f;
-    int32_t framerate_limit = 60;
-    int32_t thread_count = state.range(2);
-    int32_t substeps = 8;
-    bool gravity_on = state.range(3);
-    int32_t collision_resolver = state.range(1);
-    
-    for (auto _ : state) {
-        tp::ThreadPool thread_pool(thread_count);
-        Solver solver(
-            sf::Vector2f(window_width, window_height),
-            substeps,
-            radius,
-            max_object_count,
-            framerate_limit,
-            speed_colouring,
-            thread_pool,
-            gravity_on
-        );
-        sf::Clock clock;
-        RNG<float> rng;
-        for (int i = 0; i < max_object_count; ++i) {
-            sf::Vector2f spawn_position(rng.getRange(window_width), rng.getRange(window_height));
-            VerletObject object = solver.addObject(spawn_position, radius);
-            const float t = solver.time;
-            const float angle = max_angle * sin(t) + M_PI * 0.5f;
-            solver.setObjectVelocity(object, spawn_speed * sf::Vector2f{cos(angle), sin(angle)});
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "../distributed/domain.hpp"
+#include "../distributed/transport.hpp"
+#include "../physics/solver.hpp"
+#include "../physics/spatial-query.hpp"
+#include "../simulation/ensemble.hpp"
+#include "scenes.hpp"
+
+constexpr int32_t WINDOW_WIDTH = 2000;
+constexpr int32_t WINDOW_HEIGHT = 2000;
+constexpr int32_t FRAMERATE = 60;
+constexpr int32_t SUBSTEPS = 8;
+
+struct HardwareTotals {
+    PhaseCounters phases{};
+    std::vector<CounterValues> workers;
+};
+
+static void accumulateHardwareCounters(HardwareTotals &totals, const SolverStats &stats) {
+    totals.workers.resize(stats.worker_hardware.size());
+    for (int32_t worker = 0; worker < stats.worker_hardware.size(); ++worker) {
+        for (int32_t phase = 0; phase < SOLVER_PHASE_COUNT; ++phase) {
+            totals.phases[phase] += stats.worker_hardware[worker][phase];
+            totals.workers[worker] += stats.worker_hardware[worker][phase];
         }
-        for (int i = 0; i < state.range(0); ++i) {
-            switch (collision_resolver) {
-                case 2: solver.updateNaive(); break;
-                case 1: solver.updateCellular(); break;
-                default: solver.updateThreaded();
-            }
+    }
+}
+
+static void reportHardwareCounters(benchmark::State &state, const HardwareTotals &totals) {
+    if (!PERF_COUNTERS_ENABLED) return;
+    for (int32_t phase = 0; phase < SOLVER_PHASE_COUNT; ++phase) {
+        for (int32_t counter = 0; counter < HARDWARE_COUNTER_COUNT; ++counter) {
+            state.counters[std::string(SOLVER_PHASE_NAMES[phase]) + "_" + HARDWARE_COUNTER_NAMES[counter]] =
+                benchmark::Counter(totals.phases[phase].values[counter], benchmark::Counter::kAvgIterations);
+        }
+    }
+    for (int32_t worker = 0; worker < totals.workers.size(); ++worker) {
+        const std::string prefix = worker ? "worker" + std::to_string(worker - 1) : "main";
+        for (int32_t counter = 0; counter < HARDWARE_COUNTER_COUNT; ++counter) {
+            state.counters[prefix + "_" + HARDWARE_COUNTER_NAMES[counter]] =
+                benchmark::Counter(totals.workers[worker].values[counter], benchmark::Counter::kAvgIterations);
         }
     }
-    state.SetComplexityN(state.range(state.range(6)));
 }
 
 /*
 
-Benchmark format is as follows:
+Every benchmark runs on a fixture whose ranges are:
+    0: [scene, see Scene in scenes.hpp],
+    1: [object count],
+    2: [number of threads to use],
+    3: [collision resolver selection] (full-step benchmarks only).
 
-BENCHMARK(BM_updateSimulation)
-->Name([test name])
-->ArgsProduct({
-    0: [number of updates to test],
-    1: [collision resolver selection],
+The thread pool, solver and scene are built (and, for piles and soft-body
+stacks, settled) in SetUp, outside the timed region.
+
+*/
+
+class SceneFixture : public benchmark::Fixture {
+public:
+    std::unique_ptr<tp::ThreadPool> thread_pool;
+    std::unique_ptr<Solver> solver;
+    HardwareTotals hardware_totals;
+
+    void SetUp(const benchmark::State &state) override {
+        const Scene scene = static_cast<Scene>(state.range(0));
+        const int32_t object_count = state.range(1);
+        thread_pool = std::make_unique<tp::ThreadPool>(state.range(2));
+        solver = std::make_unique<Solver>(
+            sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT),
+            SUBSTEPS,
+            2.0f * SCENE_RADIUS,
+            object_count,
+            FRAMERATE,
+            false,
+            *thread_pool,
+            true
+        );
+        SceneBuilder{*solver, sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT)}.build(scene, object_count);
+        solver->resetStats();
+        hardware_totals = HardwareTotals{};
+    }
+
+    void TearDown(const benchmark::State &) override {
+        solver.reset();
+        thread_pool.reset();
+    }
+
+    void report(benchmark::State &state, int64_t substeps_per_iteration) {
+        const double particle_substeps =
+            static_cast<double>(solver->objects.size()) * substeps_per_iteration;
+        state.counters["particle_substeps"] =
+            benchmark::Counter(particle_substeps, benchmark::Counter::kIsIterationInvariantRate);
+        state.SetLabel(SCENE_NAMES[state.range(0)]);
+        accumulateHardwareCounters(hardware_totals, solver->getStats());
+        reportHardwareCounters(state, hardware_totals);
+    }
+};
+
+BENCHMARK_DEFINE_F(SceneFixture, grid_build)(benchmark::State &state) {
+    for (auto _ : state) {
+        solver->addObjectsToGrid();
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, narrow_phase)(benchmark::State &state) {
+    solver->addObjectsToGrid();
+    for (auto _ : state) {
+        solver->solveCollisionsThreaded();
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, constraints)(benchmark::State &state) {
+    for (auto _ : state) {
+        solver->updateConstraints();
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, soft_bodies)(benchmark::State &state) {
+    for (auto _ : state) {
+        solver->updateSoftBodies();
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, soft_bodies_threaded)(benchmark::State &state) {
+    for (auto _ : state) {
+        solver->updateSoftBodiesThreaded();
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, integration)(benchmark::State &state) {
+    const float step_dt = solver->getStepDt();
+    for (auto _ : state) {
+        solver->updateObjectsThreaded(step_dt);
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, long_range)(benchmark::State &state) {
+    solver->setLongRangeForce(1.0f);
+    for (auto _ : state) {
+        solver->updateLongRangeForcesThreaded();
+    }
+    report(state, 1);
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, full_step)(benchmark::State &state) {
+    for (auto _ : state) {
+        switch (state.range(3)) {
+            case 3: solver->updateJacobi(); break;
+            case 2: solver->updateNaive(); break;
+            case 1: solver->updateCellular(); break;
+            default: solver->updateThreaded();
+        }
+    }
+    report(state, solver->getSubsteps());
+}
+
+BENCHMARK_DEFINE_F(SceneFixture, spatial_index)(benchmark::State &state) {
+    SpatialIndex index;
+    for (auto _ : state) {
+        index.build(*solver);
+    }
+    report(state, 1);
+}
+
+/*
+
+The spatial_queries benchmark answers a batch of SPATIAL_QUERY_COUNT
+queries of one type at random points of a built index, with ranges:
+    0: [scene type],
+    1: [number of objects],
     2: [number of threads to use],
-    3: [gravity on/off],
-    4: [colouring method],
-    5: [max object count],
-    6: [time complexity state variable index],
-});
+    3: [query type: 0 radius, 1 box, 2 nearest, 3 ray].
 
 */
 
-BENCHMARK(BM_updateSimulation)
-->Name("thread_count")
-->ArgsProduct({
-    {500},
-    {0},
-    benchmark::CreateDenseRange(2, 8, 1),
-    {0},
-    {0},
-    {1000},
-    {0},
-})
-->MeasureProcessCPUTime();
+constexpr uint32_t SPATIAL_QUERY_COUNT = 4096;
+constexpr float SPATIAL_QUERY_RADIUS = 50.0f;
+constexpr uint32_t SPATIAL_QUERY_NEAREST = 8;
 
-BENCHMARK(BM_updateSimulation)
-->Name("resolver_brute_force_updates")
-->ArgsProduct({
-    {5, 10, 25, 50, 100, 250, 500, 1000},
-    {2},
-    {1},
-    {0},
-    {0},
-    {1000},
-    {0},
-})
-->Complexity()
-->MeasureProcessCPUTime();
+BENCHMARK_DEFINE_F(SceneFixture, spatial_queries)(benchmark::State &state) {
+    const SpatialQuery::Type type = static_cast<SpatialQuery::Type>(state.range(3));
+    SpatialIndex index;
+    index.build(*solver);
+    SpatialQueryBatch batch;
+    RNG<float> rng{SCENE_SEED};
+    for (uint32_t i=0; i<SPATIAL_QUERY_COUNT; i++) {
+        const sf::Vector2f point{rng.getRange(0.0f, WINDOW_WIDTH), rng.getRange(0.0f, WINDOW_HEIGHT)};
+        const sf::Vector2f offset{rng.getRange(-1.0f, 1.0f), rng.getRange(-1.0f, 1.0f)};
+        const sf::Vector2f box_end = point + sf::Vector2f{SPATIAL_QUERY_RADIUS, SPATIAL_QUERY_RADIUS};
+        const sf::Vector2f ray_end = point + 10.0f * SPATIAL_QUERY_RADIUS * offset;
+        batch.add({type, point, type == SpatialQuery::Ray ? ray_end : box_end,
+                   SPATIAL_QUERY_RADIUS, type == SpatialQuery::Ray ? 1 : SPATIAL_QUERY_NEAREST});
+    }
+    for (auto _ : state) {
+        batch.run(index, *thread_pool);
+    }
+    state.counters["queries"] = benchmark::Counter(
+        SPATIAL_QUERY_COUNT, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["hits_per_query"] = static_cast<double>(batch.hits.size()) / SPATIAL_QUERY_COUNT;
+}
 
-BENCHMARK(BM_updateSimulation)
-->Name("resolver_spatial_partitioning_updates")
-->ArgsProduct({
-    {5, 10, 25, 50, 100, 250, 500, 1000},
-    {1},
-    {1},
-    {0},
-    {0},
-    {1000},
-    {0},
-})
-->Complexity()
-->MeasureProcessCPUTime();
+/*
 
-BENCHMARK(BM_updateSimulation)
-->Name("resolver_multithreaded_updates")
-->ArgsProduct({
-    {5, 10, 25, 50, 100, 250, 500, 1000},
-    {0},
-    {3},
-    {0},
-    {0},
-    {1000},
-    {0},
-})
-->Complexity()
-->MeasureProcessCPUTime();
+The static_colliders benchmark integrates a scene with level geometry
+added, with ranges:
+    0: [scene type],
+    1: [number of objects],
+    2: [number of threads to use],
+    3: [number of static segments, laid out on a regular lattice].
 
-BENCHMARK(BM_updateSimulation)
-->Name("resolver_brute_force_objects")
-->ArgsProduct({
-    {500},
-    {2},
-    {1},
-    {0},
-    {0},
-    {10, 50, 100, 250, 500, 1000},
-    {5},
-})
-->Complexity()
-->MeasureProcessCPUTime();
+*/
+
+constexpr float STATIC_SEGMENT_LENGTH = 40.0f;
+
+BENCHMARK_DEFINE_F(SceneFixture, static_colliders)(benchmark::State &state) {
+    const int32_t side = static_cast<int32_t>(std::sqrt(static_cast<float>(state.range(3))));
+    for (int32_t x=0; x<side; x++) {
+        for (int32_t y=0; y<side; y++) {
+            const sf::Vector2f start{(x + 0.5f) * WINDOW_WIDTH / side, (y + 0.5f) * WINDOW_HEIGHT / side};
+            solver->addStaticSegment(start, start + sf::Vector2f{STATIC_SEGMENT_LENGTH, 0.5f * STATIC_SEGMENT_LENGTH});
+        }
+    }
+    const float step_dt = solver->getStepDt();
+    for (auto _ : state) {
+        solver->updateObjectsThreaded(step_dt);
+    }
+    report(state, 1);
+}
+
+/*
+
+The level_of_detail benchmark steps whole frames with only a strip along
+the left wall, DETAIL_REGION_FRACTION of the window wide, kept at the full
+rate, with ranges:
+    0: [scene type],
+    1: [number of objects],
+    2: [number of threads to use],
+    3: [substeps between the steps of everything outside the strip].
+The rest speed is zero, so nothing else is promoted by its activity.
+
+*/
+
+constexpr float DETAIL_REGION_FRACTION = 0.125f;
+
+BENCHMARK_DEFINE_F(SceneFixture, level_of_detail)(benchmark::State &state) {
+    solver->setCoarseInterval(state.range(3), 0.0f);
+    solver->addDetailRegion({0.0f, 0.0f}, {DETAIL_REGION_FRACTION * WINDOW_WIDTH, WINDOW_HEIGHT});
+    for (auto _ : state) {
+        solver->updateThreaded();
+    }
+    state.counters["coarse_objects"] = solver->getCoarseCount();
+    report(state, solver->getSubsteps());
+}
+
+/*
+
+The ensemble benchmark steps many small scattered scenes, one worker per
+scene, with ranges:
+    0: [number of scenes],
+    1: [objects per scene],
+    2: [number of threads to use].
+
+*/
+
+static void ensemble(benchmark::State &state) {
+    constexpr float ENSEMBLE_SIZE = 400.0f;
+    tp::ThreadPool thread_pool(state.range(2));
+    Ensemble scenes{thread_pool, {ENSEMBLE_SIZE, ENSEMBLE_SIZE}, 2.0f * SCENE_RADIUS,
+                    static_cast<int32_t>(state.range(1)), FRAMERATE, true};
+    scenes.create(state.range(0), [&](Solver &solver, uint32_t) {
+        SceneBuilder{solver, {ENSEMBLE_SIZE, ENSEMBLE_SIZE}}.build(Scene::Scattered, state.range(1));
+    });
+    for (auto _ : state) {
+        scenes.run(1);
+    }
+    state.counters["particle_substeps"] = benchmark::Counter(
+        static_cast<double>(scenes.getStats().particle_substeps), benchmark::Counter::kIsRate);
+}
+
+/*
+
+The slab_domain benchmarks step a scattered scene split across ranks by a
+SlabDomain, one thread per rank, for SLAB_DOMAIN_FRAMES frames, with
+ranges:
+    0: [number of ranks],
+    1: [number of objects, over all ranks].
+Each rank steps with the cellular resolver on its own solver. The timed
+loop runs on rank 0; the other ranks step the same number of frames.
 
-BENCHMARK(BM_updateSimulation)
-->Name("resolver_spatial_partitioning_objects")
+*/
+
+constexpr int64_t SLAB_DOMAIN_FRAMES = 60;
+
+template <typename Transport, typename RunCallback>
+static void runSlabRank(Transport &transport, int32_t object_count, RunCallback &&run) {
+    tp::ThreadPool thread_pool(1);
+    Solver solver{sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT), SUBSTEPS, 2.0f * SCENE_RADIUS,
+                  object_count, FRAMERATE, false, thread_pool, true};
+    SlabDomain<Transport> domain{solver, transport};
+    RNG<float> rng{SCENE_SEED};
+    const float margin = 2.0f * SCENE_RADIUS;
+    for (int32_t i=0; i<object_count; i++) {
+        domain.addObject({rng.getRange(margin, WINDOW_WIDTH - margin), rng.getRange(margin, WINDOW_HEIGHT - margin)},
+                         SCENE_RADIUS);
+    }
+    run(domain);
+}
+
+template <typename Transport, typename TransportFactory>
+static void slabDomain(benchmark::State &state, TransportFactory &&makeTransport) {
+    const uint32_t rank_count = state.range(0);
+    const int32_t object_count = state.range(1);
+    const auto update = [](Solver &solver) { solver.updateCellular(); };
+    std::vector<std::thread> ranks;
+    for (uint32_t rank=1; rank<rank_count; rank++) {
+        ranks.emplace_back([&, rank]() {
+            Transport transport = makeTransport(rank);
+            runSlabRank(transport, object_count, [&](SlabDomain<Transport> &domain) {
+                for (int64_t frame=0; frame<state.max_iterations; frame++) {
+                    domain.step(update);
+                }
+            });
+        });
+    }
+    Transport transport = makeTransport(0);
+    bool connected = true;
+    runSlabRank(transport, object_count, [&](SlabDomain<Transport> &domain) {
+        for (auto _ : state) {
+            connected = domain.step(update) && connected;
+        }
+        state.counters["rank_objects"] = domain.getOwnedCount();
+        state.counters["rank_ghosts"] = domain.getGhostCount();
+    });
+    for (std::thread &rank : ranks) {
+        rank.join();
+    }
+    if (!connected) {
+        state.SkipWithError("a neighbouring rank could not be reached");
+    }
+    state.counters["particle_substeps"] = benchmark::Counter(
+        static_cast<double>(object_count) * SUBSTEPS, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void slab_domain_local(benchmark::State &state) {
+    LocalTransport::Network network(state.range(0));
+    slabDomain<LocalTransport>(state, [&](uint32_t rank) { return LocalTransport{network, rank}; });
+}
+
+static void slab_domain_socket(benchmark::State &state) {
+    const std::string path_prefix = "/tmp/slab_domain_" + std::to_string(::getpid()) + "_";
+    slabDomain<SocketTransport>(state, [&](uint32_t rank) {
+        return SocketTransport{path_prefix, rank, static_cast<uint32_t>(state.range(0))};
+    });
+}
+
+static std::vector<int64_t> threadCounts() {
+    std::vector<int64_t> counts;
+    const int64_t hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int64_t count = 1; count < hardware_threads; count *= 2) {
+        counts.push_back(count);
+    }
+    counts.push_back(hardware_threads);
+    return counts;
+}
+
+static const std::vector<int64_t> ALL_SCENES = benchmark::CreateDenseRange(
+    static_cast<int64_t>(Scene::Scattered), static_cast<int64_t>(Scene::MixedRadii), 1);
+
+BENCHMARK_REGISTER_F(SceneFixture, grid_build)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({ALL_SCENES, {10000}, {1}})
+->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_REGISTER_F(SceneFixture, narrow_phase)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({ALL_SCENES, {10000}, threadCounts()})
+->Unit(benchmark::kMicrosecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, constraints)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Ropes), static_cast<int64_t>(Scene::SoftBodyStack)}, {2000, 10000}, {1}})
+->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_REGISTER_F(SceneFixture, soft_bodies)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({{static_cast<int64_t>(Scene::SoftBodyStack)}, {2000, 10000}, {1}})
+->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_REGISTER_F(SceneFixture, soft_bodies_threaded)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({{static_cast<int64_t>(Scene::SoftBodyStack)}, {2000, 10000}, threadCounts()})
+->Unit(benchmark::kMicrosecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, integration)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Scattered)}, {10000, 40000}, threadCounts()})
+->Unit(benchmark::kMicrosecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, long_range)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Scattered), static_cast<int64_t>(Scene::SettledPile)}, {10000, 40000}, threadCounts()})
+->Unit(benchmark::kMicrosecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, full_step)
+->Name("thread_scaling")
+->ArgNames({"scene", "objects", "threads", "resolver"})
+->ArgsProduct({ALL_SCENES, {10000}, threadCounts(), {0, 3}})
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, full_step)
+->Name("object_scaling")
+->ArgNames({"scene", "objects", "threads", "resolver"})
 ->ArgsProduct({
-    {500},
-    {1},
-    {1},
-    {0},
-    {0},
-    benchmark::CreateDenseRange(1000, 30000, 1000),
-    {5},
+    {static_cast<int64_t>(Scene::Scattered), static_cast<int64_t>(Scene::SettledPile)},
+    {1000, 2500, 5000, 10000, 15000},
+    {static_cast<int64_t>(std::max(1u, std::thread::hardware_concurrency()))},
+    {0, 1},
 })
-->Complexity()
-->MeasureProcessCPUTime();
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, full_step)
+->Name("resolver_brute_force")
+->ArgNames({"scene", "objects", "threads", "resolver"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Scattered)}, {100, 250, 500, 1000}, {1}, {2}})
+->Unit(benchmark::kMillisecond);
+
+BENCHMARK_REGISTER_F(SceneFixture, spatial_index)
+->ArgNames({"scene", "objects", "threads"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Scattered)}, {10000, 40000}, {1}})
+->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_REGISTER_F(SceneFixture, spatial_queries)
+->ArgNames({"scene", "objects", "threads", "query"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Scattered)}, {10000, 40000}, threadCounts(), {0, 1, 2, 3}})
+->Unit(benchmark::kMicrosecond)
+->UseRealTime();
+
+BENCHMARK_REGISTER_F(SceneFixture, static_colliders)
+->ArgNames({"scene", "objects", "threads", "segments"})
+->ArgsProduct({{static_cast<int64_t>(Scene::Scattered)}, {10000, 40000}, {1}, {0, 256, 4096}})
+->Unit(benchmark::kMicrosecond)
+->UseRealTime();
 
-BENCHMARK(BM_updateSimulation)
-->Name("resolver_multithreaded_objects")
+BENCHMARK_REGISTER_F(SceneFixture, level_of_detail)
+->ArgNames({"scene", "objects", "threads", "interval"})
 ->ArgsProduct({
-    {100},
-    {0},
-    {3},
-    {0},
-    {0},
-    benchmark::CreateDenseRange(1000, 10000, 250),
-    {5},
+    {static_cast<int64_t>(Scene::Scattered), static_cast<int64_t>(Scene::SettledPile)},
+    {40000},
+    threadCounts(),
+    {1, 2, 4, 8},
 })
-->Complexity()
-->MeasureProcessCPUTime();
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
 
-BENCHMARK(BM_updateSimulation)
-->Name("colouring_method")
-->ArgsProduct({
-    {500},
-    {0},
-    {3},
-    {0, 1},
-    {0},
-});
+BENCHMARK(ensemble)
+->ArgNames({"scenes", "objects", "threads"})
+->ArgsProduct({{256, 1024}, {200}, threadCounts()})
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
+
+BENCHMARK(slab_domain_local)
+->ArgNames({"ranks", "objects"})
+->ArgsProduct({{1, 2, 4}, {10000}})
+->Iterations(SLAB_DOMAIN_FRAMES)
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
+
+BENCHMARK(slab_domain_socket)
+->ArgNames({"ranks", "objects"})
+->ArgsProduct({{2, 4}, {10000}})
+->Iterations(SLAB_DOMAIN_FRAMES)
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
 
 BENCHMARK_MAIN();
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <SFML/Graphics.hpp>
+
+#include "../physics/solver.hpp"
+#include "../utils/maths.hpp"
+
+constexpr uint32_t SCENE_SEED = 1234;
+constexpr float SCENE_RADIUS = 10.0f;
+constexpr float SCENE_MIN_RADIUS = 4.0f;
+constexpr float SCENE_ROPE_SEGMENT = 10.0f;
+constexpr float SCENE_ROPE_RADIUS = 4.0f;
+constexpr int32_t SCENE_ROPE_LENGTH = 40;
+constexpr int32_t SCENE_SOFT_BODY_POINTS = 32;
+constexpr float SCENE_SOFT_BODY_RADIUS = 40.0f;
+constexpr int32_t SCENE_SETTLE_FRAMES = 120;
+
+enum class Scene : int32_t {
+    Scattered,
+    SettledPile,
+    Ropes,
+    SoftBodyStack,
+    MixedRadii,
+};
+
+constexpr const char *SCENE_NAMES[] = {
+    "scattered", "settled_pile", "ropes", "soft_body_stack", "mixed_radii"
+};
+
+// Scene generators build directly on a Solver, without a window, and are
+// seeded so every benchmark run starts from the same state. object_count is
+// the total number of particles, including rope and soft-body vertices.
+struct SceneBuilder {
+    Solver &solver;
+    sf::Vector2f size;
+    RNG<float> rng{SCENE_SEED};
+
+    void build(Scene scene, int32_t object_count) {
+        switch (scene) {
+            case Scene::Scattered: buildScattered(object_count, SCENE_RADIUS, SCENE_RADIUS); break;
+            case Scene::SettledPile: buildPile(object_count); break;
+            case Scene::Ropes: buildRopes(object_count); break;
+            case Scene::SoftBodyStack: buildSoftBodyStack(object_count); break;
+            case Scene::MixedRadii: buildScattered(object_count, SCENE_MIN_RADIUS, SCENE_RADIUS); break;
+        }
+    }
+
+    void buildScattered(int32_t object_count, float min_radius, float max_radius) {
+        const float margin = MARGIN_WIDTH + max_radius;
+        for (int32_t i = 0; i < object_count; ++i) {
+            const sf::Vector2f position{rng.getRange(margin, size.x - margin),
+                                        rng.getRange(margin, size.y - margin)};
+            VerletObject &object = solver.addObject(position, rng.getRange(min_radius, max_radius));
+            const float angle = rng.getUnder(2.0f * M_PI);
+            solver.setObjectVelocity(object, 10.0f * sf::Vector2f{std::cos(angle), std::sin(angle)});
+        }
+    }
+
+    // A hexagonally packed heap against the left wall, so occupancy is
+    // concentrated in the bottom rows and in a minority of columns.
+    void buildPile(int32_t object_count) {
+        const float spacing = 2.0f * SCENE_RADIUS;
+        const float row_height = spacing * 0.866f;
+        const int32_t max_rows = static_cast<int32_t>((size.y - spacing) / row_height);
+        const int32_t max_per_row = static_cast<int32_t>(size.x / spacing) - 1;
+        const int32_t per_row = std::min(max_per_row, std::max({1,
+            static_cast<int32_t>(0.4f * size.x / spacing), (object_count + max_rows - 1) / max_rows}));
+        for (int32_t i = 0; i < object_count; ++i) {
+            const int32_t row = i / per_row;
+            const int32_t column = i % per_row;
+            const sf::Vector2f position{
+                MARGIN_WIDTH + SCENE_RADIUS + column * spacing + (row % 2) * 0.5f * spacing,
+                size.y - MARGIN_WIDTH - SCENE_RADIUS - row * row_height};
+            solver.addObject(position, SCENE_RADIUS);
+        }
+        settle();
+    }
+
+    void buildRopes(int32_t object_count) {
+        const int32_t rope_count = std::max(1, object_count / SCENE_ROPE_LENGTH);
+        const float gap = size.x / (rope_count + 1);
+        for (int32_t rope = 0; rope < rope_count; ++rope) {
+            const int32_t body_id = solver.body_count++;
+            VerletObject *last_object = nullptr;
+            for (int32_t i = 0; i < SCENE_ROPE_LENGTH; ++i) {
+                const sf::Vector2f position{(rope + 1) * gap + (i ? 0.3f * i : 0.0f),
+                                            4.0f * SCENE_RADIUS + i * SCENE_ROPE_SEGMENT};
+                solver.body[solver.objects.size()] = body_id;
+                VerletObject &object = solver.addObject(position, SCENE_ROPE_RADIUS, !last_object);
+                if (last_object) {
+                    solver.addConstraint(*last_object, object, SCENE_ROPE_SEGMENT).in_body = true;
+                }
+                last_object = &object;
+            }
+        }
+    }
+
+    void buildSoftBodyStack(int32_t object_count) {
+        const int32_t body_count = std::max(1, object_count / SCENE_SOFT_BODY_POINTS);
+        const float spacing = 2.5f * SCENE_SOFT_BODY_RADIUS;
+        const int32_t per_row = std::max(1, static_cast<int32_t>(size.x / spacing) - 1);
+        const float segment = 2.0f * M_PI * SCENE_SOFT_BODY_RADIUS / SCENE_SOFT_BODY_POINTS;
+        for (int32_t b = 0; b < body_count; ++b) {
+            const sf::Vector2f centre{spacing * (1 + b % per_row),
+                                      size.y - spacing * (1 + b / per_row)};
+            const int32_t body_id = solver.body_count++;
+            std::vector<VerletObject *> vertices;
+            for (int32_t i = 0; i < SCENE_SOFT_BODY_POINTS; ++i) {
+                const float angle = 2.0f * M_PI * i / SCENE_SOFT_BODY_POINTS;
+                solver.body[solver.objects.size()] = body_id;
+                vertices.push_back(&solver.addObject(
+                    centre + SCENE_SOFT_BODY_RADIUS * sf::Vector2f{std::cos(angle), std::sin(angle)},
+                    SCENE_ROPE_RADIUS));
+            }
+            std::vector<VerletConstraint *> segments;
+            for (int32_t i = 0; i < SCENE_SOFT_BODY_POINTS; ++i) {
+                VerletConstraint &constraint = solver.addConstraint(
+                    *vertices[i], *vertices[(i + 1) % SCENE_SOFT_BODY_POINTS], segment);
+                constraint.in_body = true;
+                segments.push_back(&constraint);
+            }
+            solver.addSoftBody(vertices, segments, SCENE_SOFT_BODY_RADIUS);
+        }
+        settle();
+    }
+
+    void settle() {
+        for (int32_t i = 0; i < SCENE_SETTLE_FRAMES; ++i) {
+            solver.updateThreaded();
+        }
+        solver.resetStats();
+    }
+};
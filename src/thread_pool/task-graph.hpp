@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace tp {
+    // Tasks with dependencies between them. A run counts down the unfinished
+    // dependencies of every task, and whichever worker finishes the last
+    // dependency of a task enqueues it, so each task starts as soon as its
+    // own inputs are ready instead of waiting at a barrier for everything.
+    struct TaskGraph {
+        using TaskId = uint32_t;
+
+        // A task with a worker id always runs on that worker.
+        template<typename TaskCallback>
+        TaskId addTask(TaskCallback&& callback, int32_t worker_id = -1) {
+            nodes.push_back({std::forward<TaskCallback>(callback), worker_id, {}, 0});
+            return nodes.size() - 1;
+        }
+
+        void addDependency(TaskId before, TaskId after) {
+            nodes[before].successors.push_back(after);
+            nodes[after].dependency_count++;
+        }
+
+        void clear() {
+            nodes.clear();
+        }
+
+        uint32_t size() const {
+            return nodes.size();
+        }
+
+        // Runs every task once and returns when all have finished. The graph
+        // must be acyclic.
+        void run(ThreadPool &thread_pool) {
+            if (remaining_size < nodes.size()) {
+                remaining = std::make_unique<std::atomic<uint32_t>[]>(nodes.size());
+                remaining_size = nodes.size();
+            }
+            for (TaskId id=0; id<nodes.size(); id++) {
+                remaining[id] = nodes[id].dependency_count;
+            }
+            for (TaskId id=0; id<nodes.size(); id++) {
+                if (!nodes[id].dependency_count) {
+                    enqueue(thread_pool, id);
+                }
+            }
+            thread_pool.completeAllTasks();
+        }
+
+    private:
+        struct Node {
+            std::function<void()> callback;
+            int32_t worker_id;
+            std::vector<TaskId> successors;
+            uint32_t dependency_count;
+        };
+
+        std::vector<Node> nodes;
+        std::unique_ptr<std::atomic<uint32_t>[]> remaining;
+        uint32_t remaining_size = 0;
+
+        // Successors are enqueued before this task finishes, so the pool never
+        // sees a moment with no incomplete tasks until the whole graph is done.
+        void enqueue(ThreadPool &thread_pool, TaskId id) {
+            const auto task = [this, &thread_pool, id](){
+                nodes[id].callback();
+                for (const TaskId successor : nodes[id].successors) {
+                    if (remaining[successor].fetch_sub(1) == 1) {
+                        enqueue(thread_pool, successor);
+                    }
+                }
+            };
+            if (nodes[id].worker_id >= 0) {
+                thread_pool.enqueueTaskFor(nodes[id].worker_id, task);
+            } else {
+                thread_pool.enqueueTask(task);
+            }
+        }
+    };
+}
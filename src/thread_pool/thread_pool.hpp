@@ -8,16 +8,26 @@
 #include <atomic>
 #include <condition_variable>
 
+#include "topology.hpp"
+
 namespace tp {
+    inline thread_local int32_t this_worker_id = -1;
+
+    // Tasks either go to the shared queue, which any worker takes from, or to
+    // one worker's affine queue, which only that worker takes from and which
+    // it drains first.
     struct TaskQueue {
         std::queue<std::function<void()>> tasks;
+        std::vector<std::queue<std::function<void()>>> affine_tasks;
         std::mutex mutex;
         std::condition_variable condition;
         std::atomic<bool> stop;
         std::atomic<uint32_t> incomplete_tasks;
 
-        TaskQueue()
-            : stop{false}
+        explicit
+        TaskQueue(uint32_t worker_count = 0)
+            : affine_tasks(worker_count)
+            , stop{false}
             , incomplete_tasks{0}
         {}
 
@@ -31,14 +41,26 @@ namespace tp {
             condition.notify_one();
         }
 
-        bool dequeueTask(std::function<void()>& target_callback) {
+        template<typename TaskCallback>
+        void enqueueTaskFor(uint32_t worker_id, TaskCallback&& callback) {
+            {
+                std::lock_guard<std::mutex> lock_guard{mutex};
+                affine_tasks[worker_id].push(std::forward<TaskCallback>(callback));
+                incomplete_tasks++;
+            }
+            condition.notify_all();
+        }
+
+        bool dequeueTask(uint32_t worker_id, std::function<void()>& target_callback) {
             std::unique_lock<std::mutex> lock{mutex};
-            condition.wait(lock, [this]{
-                return !tasks.empty() || stop;
+            std::queue<std::function<void()>> &own_tasks = affine_tasks[worker_id];
+            condition.wait(lock, [this, &own_tasks]{
+                return !own_tasks.empty() || !tasks.empty() || stop;
             });
-            if (tasks.empty()) return false;
-            target_callback = std::move(tasks.front());
-            tasks.pop();
+            std::queue<std::function<void()>> &source = own_tasks.empty() ? tasks : own_tasks;
+            if (source.empty()) return false;
+            target_callback = std::move(source.front());
+            source.pop();
             return true;
         }
 
@@ -83,8 +105,9 @@ namespace tp {
         }
 
         void run() {
+            this_worker_id = id;
             while (thread_active) {
-                if (queue->dequeueTask(task)) {
+                if (queue->dequeueTask(id, task)) {
                     task();
                     queue->finishTask();
                 }
@@ -106,6 +129,7 @@ namespace tp {
         explicit
         ThreadPool(uint32_t thread_count)
             : thread_count{thread_count}
+            , queue{thread_count}
         {
             workers.reserve(thread_count);
             for (uint32_t i=0; i<thread_count; i++) {
@@ -125,17 +149,39 @@ namespace tp {
             queue.enqueueTask(std::forward<TaskCallback>(callback));
         }
 
+        // Runs the task on the given worker, so work that touches the same
+        // data every substep can stay in that worker's caches and memory node.
+        template<typename TaskCallback>
+        void enqueueTaskFor(uint32_t worker_id, TaskCallback&& callback) {
+            queue.enqueueTaskFor(worker_id % thread_count, std::forward<TaskCallback>(callback));
+        }
+
         void completeAllTasks() {
             queue.completeAllTasks();
         }
 
+        // Pins every worker to its own CPU, spread over the NUMA nodes of the
+        // topology as CpuTopology::getWorkerCpu describes. Returns the number
+        // of workers that could be pinned.
+        uint32_t pinWorkers(const CpuTopology &topology) {
+            std::atomic<uint32_t> pinned{0};
+            for (uint32_t i=0; i<thread_count; i++) {
+                const uint32_t cpu = topology.getWorkerCpu(i, thread_count);
+                enqueueTaskFor(i, [cpu, &pinned](){ pinned += pinCurrentThread(cpu); });
+            }
+            completeAllTasks();
+            return pinned;
+        }
+
+        // Batch i always runs on worker i, so a range of elements stays with
+        // the same worker from one call to the next.
         template<typename TaskCallback>
         void dispatch(uint32_t element_count, TaskCallback&& callback) {
             const uint32_t batch_size = element_count / thread_count;
             for (uint32_t i=0; i<thread_count; i++) {
                 const uint32_t start = batch_size * i;
                 const uint32_t end = start + batch_size;
-                enqueueTask([start, end, &callback](){ callback(start, end); });
+                enqueueTaskFor(i, [start, end, &callback](){ callback(start, end); });
             }
             if (batch_size * thread_count < element_count) {
                 const uint32_t start = batch_size * thread_count;
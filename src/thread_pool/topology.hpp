@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tp {
+    // The CPUs of each NUMA node, read from /sys/devices/system/node. On other
+    // platforms, or if sysfs is unavailable, every CPU is put on one node.
+    struct CpuTopology {
+        std::vector<std::vector<uint32_t>> nodes;
+
+        static CpuTopology discover() {
+            CpuTopology topology;
+            for (uint32_t node=0; ; node++) {
+                std::ifstream file{"/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"};
+                if (!file) break;
+                std::string list;
+                std::getline(file, list);
+                std::vector<uint32_t> cpus = parseCpuList(list);
+                if (!cpus.empty()) {
+                    topology.nodes.push_back(std::move(cpus));
+                }
+            }
+            if (topology.nodes.empty()) {
+                const uint32_t cpu_count = std::max(1u, std::thread::hardware_concurrency());
+                topology.nodes.emplace_back();
+                for (uint32_t cpu=0; cpu<cpu_count; cpu++) {
+                    topology.nodes[0].push_back(cpu);
+                }
+            }
+            return topology;
+        }
+
+        uint32_t getCpuCount() const {
+            uint32_t count = 0;
+            for (const auto &cpus : nodes) {
+                count += cpus.size();
+            }
+            return count;
+        }
+
+        // Spreads workers evenly over every CPU in node order, so consecutive
+        // workers share a node and each node gets a share of the workers in
+        // proportion to its size.
+        uint32_t getWorkerCpu(uint32_t worker, uint32_t worker_count) const {
+            const uint32_t cpu_count = getCpuCount();
+            uint32_t slot = static_cast<uint64_t>(worker) * cpu_count / std::max(1u, worker_count);
+            for (const auto &cpus : nodes) {
+                if (slot < cpus.size()) return cpus[slot];
+                slot -= cpus.size();
+            }
+            return nodes[0][0];
+        }
+
+        uint32_t getWorkerNode(uint32_t worker, uint32_t worker_count) const {
+            const uint32_t cpu = getWorkerCpu(worker, worker_count);
+            for (uint32_t node=0; node<nodes.size(); node++) {
+                if (std::find(nodes[node].begin(), nodes[node].end(), cpu) != nodes[node].end()) {
+                    return node;
+                }
+            }
+            return 0;
+        }
+
+        // Parses the "0-3,8,10-11" format used throughout sysfs.
+        static std::vector<uint32_t> parseCpuList(const std::string &list) {
+            std::vector<uint32_t> cpus;
+            size_t position = 0;
+            while (position < list.size()) {
+                size_t end = list.find(',', position);
+                if (end == std::string::npos) end = list.size();
+                const std::string range = list.substr(position, end - position);
+                const size_t dash = range.find('-');
+                if (!range.empty() && range.find_first_not_of("0123456789-\n ") == std::string::npos) {
+                    const uint32_t first = std::stoul(range.substr(0, dash));
+                    const uint32_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+                    for (uint32_t cpu=first; cpu<=last; cpu++) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                position = end + 1;
+            }
+            return cpus;
+        }
+    };
+
+    // Pins the calling thread to one CPU. Returns false where pinning is not
+    // supported or the CPU is not available to this process.
+    inline bool pinCurrentThread(uint32_t cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Bounded single-producer single-consumer ring buffer. push fails rather
+// than blocking when the queue is full.
+template <typename T, uint32_t Capacity> struct CommandQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+  bool push(const T &command) {
+    const uint32_t tail = write_index.load(std::memory_order_relaxed);
+    if (tail - read_index.load(std::memory_order_acquire) == Capacity)
+      return false;
+    commands[tail & (Capacity - 1)] = command;
+    write_index.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &command) {
+    const uint32_t head = read_index.load(std::memory_order_relaxed);
+    if (head == write_index.load(std::memory_order_acquire))
+      return false;
+    command = commands[head & (Capacity - 1)];
+    read_index.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::array<T, Capacity> commands;
+  alignas(64) std::atomic<uint32_t> write_index{0};
+  alignas(64) std::atomic<uint32_t> read_index{0};
+};
@@ -9,6 +9,13 @@ template <typename T> struct RNG {
 
   RNG() : rd{}, gen{rd()}, dis{0.0f, 1.0f} {}
 
+  explicit RNG(uint32_t seed) : rd{}, gen{seed}, dis{0.0f, 1.0f} {}
+
+  void seed(uint32_t seed) {
+    gen.seed(seed);
+    dis.reset();
+  }
+
   float get() { return dis(gen); }
 
   float getUnder(T max) { return get() * max; }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Single-producer single-consumer triple buffer. The producer always owns a
+// back buffer to fill and the consumer a front buffer to read; publishing
+// and acquiring swap with the shared middle buffer, so neither side ever
+// waits for the other and the consumer always sees the newest frame.
+template <typename T> struct TripleBuffer {
+  static constexpr uint8_t INDEX_MASK = 0b011;
+  static constexpr uint8_t FRESH_BIT = 0b100;
+
+  T &back() { return buffers[back_index]; }
+
+  const T &front() const { return buffers[front_index]; }
+
+  void publish() {
+    const uint8_t previous =
+        middle.exchange(back_index | FRESH_BIT, std::memory_order_acq_rel);
+    back_index = previous & INDEX_MASK;
+  }
+
+  bool acquire() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH_BIT))
+      return false;
+    const uint8_t previous =
+        middle.exchange(front_index, std::memory_order_acq_rel);
+    front_index = previous & INDEX_MASK;
+    return true;
+  }
+
+private:
+  T buffers[3];
+  uint8_t back_index = 0;
+  uint8_t front_index = 1;
+  std::atomic<uint8_t> middle{2};
+};